@@ -0,0 +1,589 @@
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xft/Xft.h>
+#include <xcb/xcb.h>
+#include <Imlib2.h>
+
+#include "libpmenu.h"
+#include "pmenu.h"
+
+#define CACHENAME       "apps"
+#define CACHEMAGIC      "pmenu apps 1\n"
+#define HIDDEN          (-1)            /* category of entries not shown */
+#define MAXDATADIRS     16
+
+/* submenus of the application menu, in the order they are shown */
+static const char *submenus[] = {
+	"Accessories", "Development", "Education", "Games", "Graphics",
+	"Internet", "Multimedia", "Office", "Science", "Settings", "System",
+	"Other",
+};
+
+/* main categories of desktop entries and the submenu they go into */
+static const struct {
+	const char *category;
+	int submenu;
+} categories[] = {
+	{ "AudioVideo",  6 },
+	{ "Audio",       6 },
+	{ "Video",       6 },
+	{ "Development", 1 },
+	{ "Education",   2 },
+	{ "Game",        3 },
+	{ "Graphics",    4 },
+	{ "Network",     5 },
+	{ "Office",      7 },
+	{ "Science",     8 },
+	{ "Settings",    9 },
+	{ "System",      10 },
+	{ "Utility",     0 },
+};
+
+/* directory of desktop entries */
+struct AppDir {
+	char *path;
+	char *prefix;                   /* prefix of the desktop file IDs in it */
+	int64_t mtime;
+	long parent;                    /* index of the parent directory, -1 if none */
+};
+
+/* desktop entry */
+struct App {
+	char *path;                     /* NULL once moved to a new list */
+	char *id;                       /* desktop file ID, for precedence */
+	char *name;
+	char *exec;
+	char *icon;
+	int64_t mtime;
+	size_t dir;
+	int submenu;                    /* index into submenus[], or HIDDEN */
+};
+
+/* desktop entries and the directories they were found in */
+struct Apps {
+	struct AppDir *dirs;
+	struct App *apps;
+	size_t ndirs, dircap;
+	size_t napps, appcap;
+	int changed;                    /* whether the cache must be written */
+	int nomem;                      /* whether an allocation failed */
+};
+
+/* grow the array p of *cap elements; return NULL on error, keeping it as it was */
+static void *
+grow(struct Apps *a, void *p, size_t *cap, size_t init, size_t size)
+{
+	size_t n;
+
+	n = *cap ? *cap * 2 : init;
+	if ((p = realloc(p, n * size)) == NULL) {
+		warn("realloc");
+		a->nomem = 1;
+		return NULL;
+	}
+	*cap = n;
+	return p;
+}
+
+static char *
+estrdup(struct Apps *a, const char *s)
+{
+	char *t;
+
+	if ((t = strdup(s)) == NULL) {
+		warn("strdup");
+		a->nomem = 1;
+	}
+	return t;
+}
+
+/* add a directory; return its index, or -1 on error */
+static long
+adddir(struct Apps *a, const char *path, const char *prefix, int64_t mtime, long parent)
+{
+	struct AppDir *dirs;
+
+	if (a->ndirs == a->dircap) {
+		if ((dirs = grow(a, a->dirs, &a->dircap, 16, sizeof(*a->dirs))) == NULL)
+			return -1;
+		a->dirs = dirs;
+	}
+	a->dirs[a->ndirs].path = estrdup(a, path);
+	a->dirs[a->ndirs].prefix = estrdup(a, prefix);
+	if (a->dirs[a->ndirs].path == NULL || a->dirs[a->ndirs].prefix == NULL) {
+		free(a->dirs[a->ndirs].path);
+		free(a->dirs[a->ndirs].prefix);
+		return -1;
+	}
+	a->dirs[a->ndirs].mtime = mtime;
+	a->dirs[a->ndirs].parent = parent;
+	return a->ndirs++;
+}
+
+/* add an empty entry; return NULL on error */
+static struct App *
+addapp(struct Apps *a)
+{
+	struct App *apps;
+
+	if (a->napps == a->appcap) {
+		if ((apps = grow(a, a->apps, &a->appcap, 256, sizeof(*a->apps))) == NULL)
+			return NULL;
+		a->apps = apps;
+	}
+	memset(&a->apps[a->napps], 0, sizeof(*a->apps));
+	return &a->apps[a->napps++];
+}
+
+/* move app into the list a, in directory dir */
+static void
+moveapp(struct Apps *a, struct App *app, size_t dir)
+{
+	struct App *new;
+
+	if ((new = addapp(a)) == NULL)
+		return;
+	*new = *app;
+	new->dir = dir;
+	app->path = app->id = app->name = app->exec = app->icon = NULL;
+}
+
+static void
+freeapps(struct Apps *a)
+{
+	size_t i;
+
+	for (i = 0; i < a->ndirs; i++) {
+		free(a->dirs[i].path);
+		free(a->dirs[i].prefix);
+	}
+	for (i = 0; i < a->napps; i++) {
+		free(a->apps[i].path);
+		free(a->apps[i].id);
+		free(a->apps[i].name);
+		free(a->apps[i].exec);
+		free(a->apps[i].icon);
+	}
+	free(a->dirs);
+	free(a->apps);
+}
+
+/*
+ * Unescape a value of a desktop entry in place; whitespace escapes and
+ * tabs become spaces, as the menu is read a line at a time split on tabs.
+ * Unknown escapes are kept as written.
+ */
+static void
+unescape(char *s)
+{
+	char *t;
+
+	for (t = s; *s != '\0'; s++, t++) {
+		if (*s != '\\' || s[1] == '\0') {
+			*t = (*s == '\t') ? ' ' : *s;
+			continue;
+		}
+		switch (*++s) {
+		case 's':
+		case 'n':
+		case 't':
+		case 'r':
+			*t = ' ';
+			break;
+		case '\\':
+			*t = '\\';
+			break;
+		default:
+			*t++ = '\\';
+			*t = *s;
+			break;
+		}
+	}
+	*t = '\0';
+}
+
+/* remove the field codes from the command line of a desktop entry, in place */
+static void
+stripcodes(char *s)
+{
+	char *t, *beg;
+
+	for (beg = t = s; *s != '\0'; s++) {
+		if (*s == '%') {
+			if (*++s == '%')
+				*t++ = '%';
+			else if (*s == '\0')
+				break;
+		} else if (*s != ' ' || (t > beg && t[-1] != ' ')) {
+			*t++ = *s;
+		}
+	}
+	while (t > beg && t[-1] == ' ')
+		t--;
+	*t = '\0';
+}
+
+/* get the submenu of the first main category in a Categories value */
+static int
+getsubmenu(char *list)
+{
+	char *s, *last;
+	size_t i;
+
+	for (s = strtok_r(list, ";", &last); s != NULL;
+	     s = strtok_r(NULL, ";", &last))
+		for (i = 0; i < LEN(categories); i++)
+			if (strcmp(s, categories[i].category) == 0)
+				return categories[i].submenu;
+	return LEN(submenus) - 1;
+}
+
+/* parse the desktop entry at path into app, an entry of a */
+static void
+parseapp(struct Apps *a, struct App *app, const char *path)
+{
+	FILE *fp;
+	char buf[BUFSIZ];
+	char *val, *s;
+	int inentry, isapp;
+
+	app->submenu = HIDDEN;
+	if ((fp = fopen(path, "r")) == NULL)
+		return;
+	inentry = isapp = 0;
+	app->submenu = LEN(submenus) - 1;
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		buf[strcspn(buf, "\r\n")] = '\0';
+		if (*buf == '[') {
+			inentry = strcmp(buf, "[Desktop Entry]") == 0;
+			continue;
+		}
+		if (!inentry || *buf == '#' || (val = strchr(buf, '=')) == NULL)
+			continue;
+		for (s = val; s > buf && s[-1] == ' '; s--)
+			;
+		*s = '\0';
+		for (val++; *val == ' '; val++)
+			;
+		unescape(val);
+		if (strcmp(buf, "Type") == 0) {
+			isapp = strcmp(val, "Application") == 0;
+		} else if (strcmp(buf, "Name") == 0 && app->name == NULL) {
+			app->name = estrdup(a, val);
+		} else if (strcmp(buf, "Exec") == 0 && app->exec == NULL) {
+			stripcodes(val);
+			app->exec = estrdup(a, val);
+		} else if (strcmp(buf, "Icon") == 0 && app->icon == NULL) {
+			app->icon = estrdup(a, val);
+		} else if (strcmp(buf, "Categories") == 0) {
+			if (app->submenu != HIDDEN)
+				app->submenu = getsubmenu(val);
+		} else if (strcmp(buf, "NoDisplay") == 0 || strcmp(buf, "Hidden") == 0) {
+			if (strcmp(val, "true") == 0)
+				app->submenu = HIDDEN;
+		}
+	}
+	fclose(fp);
+	if (!isapp || app->name == NULL || *app->name == '\0' ||
+	    app->exec == NULL || *app->exec == '\0')
+		app->submenu = HIDDEN;
+}
+
+/* get the next tab-separated field of *s */
+static char *
+nextfield(char **s)
+{
+	char *field, *t;
+
+	field = *s;
+	if ((t = strchr(field, '\t')) != NULL) {
+		*t = '\0';
+		*s = t + 1;
+	} else {
+		*s = field + strlen(field);
+	}
+	return field;
+}
+
+/*
+ * Read the cache file.  Each line is either a directory
+ *      D mtime parent path TAB prefix
+ * or a desktop entry in the last directory read
+ *      A mtime submenu path TAB id TAB name TAB exec TAB icon
+ * Entries not shown are kept too, as they hide entries of the same ID.
+ */
+static void
+readcache(struct Apps *a, const char *path)
+{
+	struct App *app;
+	FILE *fp;
+	char buf[BUFSIZ * 4];
+	char *s, *dirpath;
+	long long mtime;
+	long parent;
+	int submenu, n;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return;
+	if (fgets(buf, sizeof(buf), fp) == NULL || strcmp(buf, CACHEMAGIC) != 0)
+		goto done;
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		buf[strcspn(buf, "\n")] = '\0';
+		if (sscanf(buf, "D %lld %ld %n", &mtime, &parent, &n) == 2) {
+			s = buf + n;
+			dirpath = nextfield(&s);
+			if (parent >= (long)a->ndirs ||
+			    adddir(a, dirpath, s, mtime, parent) == -1)
+				break;
+		} else if (a->ndirs > 0 &&
+		           sscanf(buf, "A %lld %d %n", &mtime, &submenu, &n) == 2) {
+			s = buf + n;
+			if ((app = addapp(a)) == NULL)
+				break;
+			app->mtime = mtime;
+			app->submenu = submenu;
+			app->dir = a->ndirs - 1;
+			app->path = estrdup(a, nextfield(&s));
+			app->id = estrdup(a, nextfield(&s));
+			app->name = estrdup(a, nextfield(&s));
+			app->exec = estrdup(a, nextfield(&s));
+			app->icon = estrdup(a, nextfield(&s));
+			if (a->nomem)
+				break;
+			if (submenu < HIDDEN || submenu >= (int)LEN(submenus))
+				app->submenu = HIDDEN;
+		}
+	}
+done:
+	fclose(fp);
+}
+
+/* replace the cache file atomically */
+static void
+writecache(struct Apps *a, const char *path)
+{
+	struct App *app;
+	FILE *fp;
+	char tmp[PATH_MAX];
+	size_t i, j;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp))
+		return;
+	if ((fd = mkstemp(tmp)) == -1) {
+		warn("%s", tmp);
+		return;
+	}
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		warn("%s", tmp);
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+	fputs(CACHEMAGIC, fp);
+	for (i = 0; i < a->ndirs; i++) {
+		fprintf(fp, "D %lld %ld %s\t%s\n", (long long)a->dirs[i].mtime,
+		        a->dirs[i].parent, a->dirs[i].path, a->dirs[i].prefix);
+		for (j = 0; j < a->napps; j++) {
+			app = &a->apps[j];
+			if (app->dir != i)
+				continue;
+			fprintf(fp, "A %lld %d %s\t%s\t%s\t%s\t%s\n", (long long)app->mtime,
+			        app->submenu, app->path, app->id,
+			        app->name ? app->name : "", app->exec ? app->exec : "",
+			        app->icon ? app->icon : "");
+		}
+	}
+	if (fclose(fp) == EOF || rename(tmp, path) == -1) {
+		warn("%s", path);
+		unlink(tmp);
+	}
+}
+
+/*
+ * Add the desktop entries under the directory path to a.  If the
+ * directory did not change since the cache was written, its entries and
+ * subdirectories are taken from the cache; otherwise it is listed again
+ * and only the entries that changed are parsed.
+ */
+static void
+walk(struct Apps *a, struct Apps *old, const char *path, const char *prefix, long parent)
+{
+	struct App *app;
+	struct dirent *dp;
+	struct stat st;
+	DIR *dirp;
+	char file[PATH_MAX];
+	char sub[NAME_MAX * 2];
+	char *ext;
+	int64_t mtime, fmtime;
+	size_t i;
+	long dir, od;
+
+	if ((mtime = getmtime(path)) == NOTIME ||
+	    (dir = adddir(a, path, prefix, mtime, parent)) == -1)
+		return;
+	for (od = 0; od < (long)old->ndirs; od++)
+		if (strcmp(old->dirs[od].path, path) == 0)
+			break;
+	if (od < (long)old->ndirs && old->dirs[od].mtime == mtime) {
+		for (i = 0; i < old->napps; i++)
+			if (old->apps[i].dir == (size_t)od && old->apps[i].path != NULL)
+				moveapp(a, &old->apps[i], dir);
+		for (i = 0; i < old->ndirs; i++)
+			if (old->dirs[i].parent == od)
+				walk(a, old, old->dirs[i].path, old->dirs[i].prefix, dir);
+		return;
+	}
+	a->changed = 1;
+	if ((dirp = opendir(path)) == NULL)
+		return;
+	while ((dp = readdir(dirp)) != NULL && !a->nomem) {
+		if (dp->d_name[0] == '.')
+			continue;
+		snprintf(file, sizeof(file), "%s/%s", path, dp->d_name);
+		if (stat(file, &st) == -1)
+			continue;
+		if (S_ISDIR(st.st_mode)) {
+			snprintf(sub, sizeof(sub), "%s%s-", prefix, dp->d_name);
+			walk(a, old, file, sub, dir);
+			continue;
+		}
+		if ((ext = strrchr(dp->d_name, '.')) == NULL || strcmp(ext, ".desktop") != 0)
+			continue;
+		fmtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+		for (i = 0; i < old->napps; i++)
+			if (old->apps[i].path != NULL && strcmp(old->apps[i].path, file) == 0)
+				break;
+		if (i < old->napps && old->apps[i].mtime == fmtime) {
+			moveapp(a, &old->apps[i], dir);
+			continue;
+		}
+		if ((app = addapp(a)) == NULL)
+			break;
+		app->path = estrdup(a, file);
+		snprintf(sub, sizeof(sub), "%s%s", prefix, dp->d_name);
+		app->id = estrdup(a, sub);
+		app->mtime = fmtime;
+		app->dir = dir;
+		parseapp(a, app, file);
+	}
+	closedir(dirp);
+}
+
+static int
+appcmp(const void *a, const void *b)
+{
+	return strcasecmp((*(struct App **)a)->name, (*(struct App **)b)->name);
+}
+
+/* add a line to the hash of the tree, as if it were parsed */
+static void
+hashline(struct PMenuTree *tree, unsigned level, const char *label, const char *output)
+{
+	const char *s;
+
+	while (level-- > 0)
+		tree->hash = (tree->hash ^ '\t') * 0x100000001B3;
+	for (s = label; *s != '\0'; s++)
+		tree->hash = (tree->hash ^ (unsigned char)*s) * 0x100000001B3;
+	tree->hash = (tree->hash ^ '\t') * 0x100000001B3;
+	for (s = output; *s != '\0'; s++)
+		tree->hash = (tree->hash ^ (unsigned char)*s) * 0x100000001B3;
+	tree->hash = (tree->hash ^ '\n') * 0x100000001B3;
+}
+
+/*
+ * Build the menu tree of the applications installed, from the desktop
+ * entries in the applications directories of the XDG data directories.
+ * The entries are cached; the cache is revalidated by the modification
+ * times of the directories, and only changed entries are parsed again.
+ * Return -1 if no application is found or on error.
+ */
+int
+pmenu_tree_apps(struct PMenuTree *tree)
+{
+	struct Apps a, old;
+	struct App **list;
+	char *datadirs[MAXDATADIRS];
+	char path[PATH_MAX];
+	char cache[PATH_MAX];
+	size_t ndatadirs, nlist, i, j;
+	int cached, m, n;
+
+	memset(&a, 0, sizeof(a));
+	memset(&old, 0, sizeof(old));
+	cached = getcachepath(cache, sizeof(cache), CACHENAME) == 0;
+	if (cached)
+		readcache(&old, cache);
+	if (old.nomem) {
+		/* an entry of the cache may be incomplete; read every entry again */
+		freeapps(&old);
+		memset(&old, 0, sizeof(old));
+	}
+	if ((n = getdatadirs(datadirs, LEN(datadirs))) == -1) {
+		freeapps(&old);
+		return -1;
+	}
+	ndatadirs = n;
+	for (i = 0; i < ndatadirs; i++) {
+		snprintf(path, sizeof(path), "%s/applications", datadirs[i]);
+		walk(&a, &old, path, "", -1);
+		free(datadirs[i]);
+	}
+	if (a.ndirs != old.ndirs || a.napps != old.napps)
+		a.changed = 1;
+	freeapps(&old);
+	if (a.nomem || (list = malloc((a.napps + 1) * sizeof(*list))) == NULL) {
+		if (!a.nomem)
+			warn("malloc");
+		freeapps(&a);
+		return -1;
+	}
+	if (cached && a.changed)
+		writecache(&a, cache);
+
+	/* an entry hides the entries of the same ID in less important directories */
+	for (m = 0; m < (int)LEN(submenus); m++) {
+		nlist = 0;
+		for (i = 0; i < a.napps; i++) {
+			if (a.apps[i].submenu != m)
+				continue;
+			for (j = 0; j < i; j++)
+				if (strcmp(a.apps[j].id, a.apps[i].id) == 0)
+					break;
+			if (j == i)
+				list[nlist++] = &a.apps[i];
+		}
+		if (nlist == 0)
+			continue;
+		qsort(list, nlist, sizeof(*list), appcmp);
+		if (pmenu_tree_add(tree, 0, submenus[m], NULL, NULL) == -1)
+			break;
+		hashline(tree, 0, submenus[m], submenus[m]);
+		for (i = 0; i < nlist; i++) {
+			if (pmenu_tree_add(tree, 1, list[i]->name, list[i]->exec,
+			                   (list[i]->icon != NULL && *list[i]->icon != '\0') ?
+			                   list[i]->icon : NULL) == -1)
+				break;
+			hashline(tree, 1, list[i]->name, list[i]->exec);
+		}
+		if (i < nlist)
+			break;
+	}
+	free(list);
+	freeapps(&a);
+	return (tree->root != NULL && m == (int)LEN(submenus)) ? 0 : -1;
+}
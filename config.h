@@ -1,7 +1,10 @@
-static struct Config config = {
+static const struct PMenuConfig config = {
 	/* font, separate different fonts with comma */
 	.font = "monospace:size=9,DejaVuSansMono:size=9",
 
+	/* icon theme of icons given by name rather than by path */
+	.icon_theme = "hicolor",
+
 	/* colors */
 	.background_color = "#000000",
 	.foreground_color = "#FFFFFF",
@@ -30,5 +33,15 @@ static struct Config config = {
 	/* geometry of the right-pointing isoceles triangle for submenus */
 	.triangle_width = 3,
 	.triangle_height = 7,
-	.triangle_distance = 4  /* distance from the border of the menu */
+	.triangle_distance = 4, /* distance from the border of the menu */
+
+	/* options of the pmenu program, set by -t, -w, -s and -P */
+	.triangles = 0,         /* draw triangle for submenus */
+	.warp = 1,              /* warp the pointer into new submenus */
+	.sticky = 0,            /* keep the menus open after a selection */
+	.pixel_cache = 0,       /* keep the pixels of the root menu across runs */
+
+	/* marking menus, enabled by -g */
+	.gestures = 0,
+	.gesture_dwell = 300,   /* pause in milliseconds before menus are shown */
 };
@@ -0,0 +1,939 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <X11/Xlib.h>
+#include <X11/Xft/Xft.h>
+#include <xcb/xcb.h>
+#include <Imlib2.h>
+
+#include "libpmenu.h"
+#include "pmenu.h"
+
+#define INDEXMAGIC      "PMICONS1"
+#define NOENTRY         UINT32_MAX
+#define MAXTHEMES       16
+#define MAXBASES        16
+
+/* types of icon theme directories */
+enum {DirFixed, DirScalable, DirThreshold, DirFallback};
+
+/* file name extensions of icons, in order of preference */
+static const char *extensions[] = {".png", ".xpm", ".svg"};
+
+/*
+ * The index file is the header followed by the arrays of watched files,
+ * icon directories, entries and hash buckets, and by the strings they
+ * point into.  It is read by the same program that wrote it, so it is in
+ * native byte order and layout.
+ */
+struct IndexHeader {
+	char magic[8];
+	uint32_t nfiles;
+	uint32_t ndirs;
+	uint32_t nentries;
+	uint32_t nbuckets;              /* a power of two */
+	uint32_t strsize;
+	uint32_t pad;                   /* aligns the arrays that follow */
+};
+
+/* file whose change invalidates the structure of the index */
+struct IndexFile {
+	int64_t mtime;
+	uint32_t path;
+};
+
+/* directory of icons */
+struct IndexDir {
+	int64_t mtime;
+	uint32_t path;
+	uint16_t theme;                 /* position in the inheritance chain */
+	uint8_t type;
+	int16_t size, minsize, maxsize, threshold;
+};
+
+/* icon file of a directory */
+struct IndexEntry {
+	uint32_t name;                  /* icon name, without extension */
+	uint32_t dir;
+	uint32_t next;                  /* next entry of the same bucket */
+	uint32_t ext;                   /* index into extensions[] */
+};
+
+struct IconIndex {
+	char *buf;                      /* contents of the index */
+	size_t size;
+	int mapped;                     /* whether buf is mapped from the file */
+	struct IndexHeader *hdr;
+	struct IndexFile *files;
+	struct IndexDir *dirs;
+	struct IndexEntry *entries;
+	uint32_t *buckets;
+	char *strings;
+	uint32_t *dirfirst;             /* first entry of each directory, when rebuilt */
+};
+
+/* index being built */
+struct Builder {
+	struct IndexFile *files;
+	struct IndexDir *dirs;
+	struct IndexEntry *entries;
+	char *strings;
+	size_t nfiles, ndirs, nentries, strsize;
+	size_t filecap, dircap, entrycap, strcap;
+	int nomem;                      /* whether an allocation failed */
+};
+
+/* directory listed in an index.theme */
+struct ThemeDir {
+	char *name;
+	int size, minsize, maxsize, threshold, scale;
+	int type;
+};
+
+/* the parts of an index.theme we use */
+struct Theme {
+	char *inherits;
+	char *directories;
+	struct ThemeDir *dirs;
+	size_t ndirs;
+	int nomem;                      /* whether an allocation failed */
+};
+
+/* call realloc, warning on error */
+static void *
+erealloc(void *p, size_t size)
+{
+	if ((p = realloc(p, size)) == NULL)
+		warn("realloc");
+	return p;
+}
+
+/* call strdup, warning on error */
+static char *
+estrdup(const char *s)
+{
+	char *t;
+
+	if ((t = strdup(s)) == NULL)
+		warn("strdup");
+	return t;
+}
+
+/* grow array p of *cap elements so it holds n + 1; return NULL on error, keeping it as it was */
+static void *
+grow(void *p, size_t *cap, size_t n, size_t size)
+{
+	size_t newcap;
+
+	if (n < *cap)
+		return p;
+	newcap = *cap ? *cap * 2 : 64;
+	if ((p = erealloc(p, newcap * size)) != NULL)
+		*cap = newcap;
+	return p;
+}
+
+static uint32_t
+hashname(const char *s)
+{
+	uint32_t h;
+
+	h = 0x811C9DC5;
+	while (*s != '\0') {
+		h ^= (unsigned char)*s++;
+		h *= 0x01000193;
+	}
+	return h;
+}
+
+/* modification time of file, or NOTIME if it does not exist */
+int64_t
+getmtime(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) == -1)
+		return NOTIME;
+	return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+static uint32_t
+addstring(struct Builder *b, const char *s)
+{
+	size_t len, off, cap;
+	char *strings;
+
+	len = strlen(s) + 1;
+	for (cap = b->strcap; b->strsize + len > cap; )
+		cap = cap ? cap * 2 : 4096;
+	if (cap > b->strcap) {
+		if ((strings = erealloc(b->strings, cap)) == NULL) {
+			b->nomem = 1;
+			return 0;
+		}
+		b->strings = strings;
+		b->strcap = cap;
+	}
+	off = b->strsize;
+	memcpy(b->strings + off, s, len);
+	b->strsize += len;
+	return off;
+}
+
+static void
+addfile(struct Builder *b, const char *path)
+{
+	struct IndexFile *files;
+
+	if ((files = grow(b->files, &b->filecap, b->nfiles, sizeof(*b->files))) == NULL) {
+		b->nomem = 1;
+		return;
+	}
+	b->files = files;
+	b->files[b->nfiles].mtime = getmtime(path);
+	b->files[b->nfiles].path = addstring(b, path);
+	b->nfiles++;
+}
+
+static void
+addentry(struct Builder *b, const char *name, uint32_t dir, uint32_t ext)
+{
+	struct IndexEntry *entries;
+
+	if ((entries = grow(b->entries, &b->entrycap, b->nentries, sizeof(*b->entries))) == NULL) {
+		b->nomem = 1;
+		return;
+	}
+	b->entries = entries;
+	b->entries[b->nentries].name = addstring(b, name);
+	b->entries[b->nentries].dir = dir;
+	b->entries[b->nentries].ext = ext;
+	b->nentries++;
+}
+
+/*
+ * Check that every offset and index stored in index points inside it,
+ * that the entries are grouped by directory, and that each bucket chain
+ * ends, as the entries of a bucket are chained in increasing order;
+ * return -1 if any does not.
+ */
+static int
+checkindex(struct IconIndex *index)
+{
+	struct IndexHeader *hdr;
+	struct IndexEntry *e;
+	uint32_t i;
+
+	hdr = index->hdr;
+	for (i = 0; i < hdr->nfiles; i++)
+		if (index->files[i].path >= hdr->strsize)
+			return -1;
+	for (i = 0; i < hdr->ndirs; i++)
+		if (index->dirs[i].path >= hdr->strsize)
+			return -1;
+	for (i = 0; i < hdr->nentries; i++) {
+		e = &index->entries[i];
+		if (e->name >= hdr->strsize || e->dir >= hdr->ndirs ||
+		    (i > 0 && e->dir < e[-1].dir) || e->ext >= LEN(extensions) ||
+		    (e->next != NOENTRY && (e->next <= i || e->next >= hdr->nentries)))
+			return -1;
+	}
+	for (i = 0; i < hdr->nbuckets; i++)
+		if (index->buckets[i] != NOENTRY && index->buckets[i] >= hdr->nentries)
+			return -1;
+	return 0;
+}
+
+/* point the arrays of index into its buffer; return -1 if it is malformed */
+static int
+setindex(struct IconIndex *index)
+{
+	struct IndexHeader *hdr;
+	size_t size;
+
+	if (index->size < sizeof(*hdr))
+		return -1;
+	hdr = (struct IndexHeader *)index->buf;
+	if (memcmp(hdr->magic, INDEXMAGIC, sizeof(hdr->magic)) != 0)
+		return -1;
+	if (hdr->nbuckets == 0 || (hdr->nbuckets & (hdr->nbuckets - 1)) != 0)
+		return -1;
+	size = sizeof(*hdr) + hdr->nfiles * sizeof(struct IndexFile) +
+	       hdr->ndirs * sizeof(struct IndexDir) +
+	       hdr->nentries * sizeof(struct IndexEntry) +
+	       hdr->nbuckets * sizeof(uint32_t) + hdr->strsize;
+	if (size != index->size || hdr->strsize == 0 || index->buf[size - 1] != '\0')
+		return -1;
+	index->hdr = hdr;
+	index->files = (struct IndexFile *)(hdr + 1);
+	index->dirs = (struct IndexDir *)(index->files + hdr->nfiles);
+	index->entries = (struct IndexEntry *)(index->dirs + hdr->ndirs);
+	index->buckets = (uint32_t *)(index->entries + hdr->nentries);
+	index->strings = (char *)(index->buckets + hdr->nbuckets);
+	return checkindex(index);
+}
+
+/* map the index file; return NULL if it cannot be read or is malformed */
+static struct IconIndex *
+readindex(const char *path)
+{
+	struct IconIndex *index;
+	struct stat st;
+	void *p;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return NULL;
+	if (fstat(fd, &st) == -1 || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return NULL;
+	if ((index = erealloc(NULL, sizeof(*index))) == NULL) {
+		munmap(p, st.st_size);
+		return NULL;
+	}
+	index->buf = p;
+	index->size = st.st_size;
+	index->mapped = 1;
+	index->dirfirst = NULL;
+	if (setindex(index) == -1) {
+		warnx("%s: malformed icon index", path);
+		munmap(p, st.st_size);
+		free(index);
+		return NULL;
+	}
+	return index;
+}
+
+/* check whether any file or directory watched by index changed */
+static int
+isstale(struct IconIndex *index)
+{
+	uint32_t i;
+
+	for (i = 0; i < index->hdr->nfiles; i++)
+		if (getmtime(index->strings + index->files[i].path) != index->files[i].mtime)
+			return 1;
+	for (i = 0; i < index->hdr->ndirs; i++)
+		if (getmtime(index->strings + index->dirs[i].path) != index->dirs[i].mtime)
+			return 1;
+	return 0;
+}
+
+/* get the directory of theme named by section, adding it if needed; return NULL on error */
+static struct ThemeDir *
+getthemedir(struct Theme *theme, const char *section)
+{
+	struct ThemeDir *dir;
+	char *name;
+	size_t i;
+
+	for (i = 0; i < theme->ndirs; i++)
+		if (strcmp(theme->dirs[i].name, section) == 0)
+			return &theme->dirs[i];
+	if ((name = estrdup(section)) == NULL ||
+	    (dir = erealloc(theme->dirs, (theme->ndirs + 1) * sizeof(*theme->dirs))) == NULL) {
+		free(name);
+		theme->nomem = 1;
+		return NULL;
+	}
+	theme->dirs = dir;
+	dir = &theme->dirs[theme->ndirs++];
+	dir->name = name;
+	dir->size = 0;
+	dir->minsize = dir->maxsize = -1;
+	dir->threshold = 2;
+	dir->scale = 1;
+	dir->type = DirThreshold;
+	return dir;
+}
+
+/* parse the keys we use from an index.theme; return -1 if it cannot be read */
+static int
+parsetheme(struct Theme *theme, const char *path)
+{
+	struct ThemeDir *dir;
+	FILE *fp;
+	char buf[BUFSIZ];
+	char section[BUFSIZ];
+	char *s, *val;
+	size_t i;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	*section = '\0';
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		buf[strcspn(buf, "\r\n")] = '\0';
+		if (*buf == '[') {
+			if ((s = strchr(buf, ']')) != NULL)
+				*s = '\0';
+			snprintf(section, sizeof(section), "%s", buf + 1);
+			continue;
+		}
+		if (*buf == '#' || (val = strchr(buf, '=')) == NULL)
+			continue;
+		for (s = val; s > buf && s[-1] == ' '; s--)
+			;
+		*s = '\0';
+		for (val++; *val == ' '; val++)
+			;
+		if (strcmp(section, "Icon Theme") == 0) {
+			if (strcmp(buf, "Inherits") == 0 && theme->inherits == NULL &&
+			    (theme->inherits = estrdup(val)) == NULL)
+				theme->nomem = 1;
+			else if (strcmp(buf, "Directories") == 0 && theme->directories == NULL &&
+			         (theme->directories = estrdup(val)) == NULL)
+				theme->nomem = 1;
+			continue;
+		}
+		if (*section == '\0' || (dir = getthemedir(theme, section)) == NULL)
+			continue;
+		if (strcmp(buf, "Size") == 0)
+			dir->size = atoi(val);
+		else if (strcmp(buf, "MinSize") == 0)
+			dir->minsize = atoi(val);
+		else if (strcmp(buf, "MaxSize") == 0)
+			dir->maxsize = atoi(val);
+		else if (strcmp(buf, "Threshold") == 0)
+			dir->threshold = atoi(val);
+		else if (strcmp(buf, "Scale") == 0)
+			dir->scale = atoi(val);
+		else if (strcmp(buf, "Type") == 0) {
+			if (strcmp(val, "Fixed") == 0)
+				dir->type = DirFixed;
+			else if (strcmp(val, "Scalable") == 0)
+				dir->type = DirScalable;
+		}
+	}
+	fclose(fp);
+	for (i = 0; i < theme->ndirs; i++) {
+		if (theme->dirs[i].minsize < 0)
+			theme->dirs[i].minsize = theme->dirs[i].size;
+		if (theme->dirs[i].maxsize < 0)
+			theme->dirs[i].maxsize = theme->dirs[i].size;
+	}
+	return 0;
+}
+
+static void
+freetheme(struct Theme *theme)
+{
+	size_t i;
+
+	for (i = 0; i < theme->ndirs; i++)
+		free(theme->dirs[i].name);
+	free(theme->dirs);
+	free(theme->inherits);
+	free(theme->directories);
+}
+
+/* add name to the inheritance chain, unless it is already there; return -1 on error */
+static int
+addtheme(char *chain[], size_t *nchain, const char *name)
+{
+	size_t i;
+
+	if (*name == '\0' || *nchain >= MAXTHEMES)
+		return 0;
+	for (i = 0; i < *nchain; i++)
+		if (strcmp(chain[i], name) == 0)
+			return 0;
+	if ((chain[*nchain] = estrdup(name)) == NULL)
+		return -1;
+	(*nchain)++;
+	return 0;
+}
+
+/* free the n strings of list */
+static void
+freelist(char *list[], size_t n)
+{
+	while (n-- > 0)
+		free(list[n]);
+}
+
+/*
+ * Get the XDG data directories, most important first, into dirs; return
+ * their number, or -1 on error.  The strings are to be freed by the caller.
+ */
+int
+getdatadirs(char *dirs[], size_t max)
+{
+	char path[PATH_MAX];
+	char *home, *list, *s, *last;
+	size_t n;
+
+	n = 0;
+	home = getenv("HOME");
+	if ((s = getenv("XDG_DATA_HOME")) != NULL && *s != '\0') {
+		if ((dirs[n++] = estrdup(s)) == NULL)
+			return -1;
+	} else if (home != NULL) {
+		snprintf(path, sizeof(path), "%s/.local/share", home);
+		if ((dirs[n++] = estrdup(path)) == NULL)
+			return -1;
+	}
+	if ((s = getenv("XDG_DATA_DIRS")) == NULL || *s == '\0')
+		s = "/usr/local/share:/usr/share";
+	if ((list = estrdup(s)) == NULL) {
+		freelist(dirs, n);
+		return -1;
+	}
+	for (s = strtok_r(list, ":", &last); s != NULL && n < max;
+	     s = strtok_r(NULL, ":", &last)) {
+		if ((dirs[n++] = estrdup(s)) == NULL) {
+			freelist(dirs, n - 1);
+			free(list);
+			return -1;
+		}
+	}
+	free(list);
+	return n;
+}
+
+/* get the base directories of icons, then those of unthemed pixmaps; return -1 on error */
+static int
+getbases(char *bases[], size_t *npixmaps)
+{
+	char path[PATH_MAX];
+	char *data[MAXBASES / 2];
+	char *home;
+	size_t nbases, i;
+	int ndata;
+
+	nbases = 0;
+	if ((home = getenv("HOME")) != NULL) {
+		snprintf(path, sizeof(path), "%s/.icons", home);
+		if ((bases[nbases++] = estrdup(path)) == NULL)
+			return -1;
+	}
+	if ((ndata = getdatadirs(data, LEN(data) - 1)) == -1) {
+		freelist(bases, nbases);
+		return -1;
+	}
+	for (i = 0; i < (size_t)ndata; i++) {
+		snprintf(path, sizeof(path), "%s/icons", data[i]);
+		if ((bases[nbases++] = estrdup(path)) == NULL)
+			goto error;
+	}
+	for (i = 0; i < (size_t)ndata; i++) {
+		snprintf(path, sizeof(path), "%s/pixmaps", data[i]);
+		if ((bases[nbases + i] = estrdup(path)) == NULL) {
+			freelist(bases + nbases, i);
+			goto error;
+		}
+	}
+	freelist(data, ndata);
+	*npixmaps = ndata;
+	return nbases;
+
+error:
+	freelist(bases, nbases);
+	freelist(data, ndata);
+	return -1;
+}
+
+/* list the icons of the directory the builder last added */
+static void
+listdir(struct Builder *b, const char *path)
+{
+	struct dirent *dp;
+	DIR *dirp;
+	char *ext;
+	uint32_t i;
+
+	if ((dirp = opendir(path)) == NULL)
+		return;
+	while ((dp = readdir(dirp)) != NULL) {
+		if ((ext = strrchr(dp->d_name, '.')) == NULL || ext == dp->d_name)
+			continue;
+		for (i = 0; i < LEN(extensions); i++)
+			if (strcmp(ext, extensions[i]) == 0)
+				break;
+		if (i == LEN(extensions))
+			continue;
+		*ext = '\0';
+		addentry(b, dp->d_name, b->ndirs - 1, i);
+	}
+	closedir(dirp);
+}
+
+/* find the first entry of each directory of index, as they are grouped by directory; return -1 on error */
+static int
+indexdirs(struct IconIndex *index)
+{
+	uint32_t i, d;
+
+	if ((index->dirfirst = erealloc(NULL, (index->hdr->ndirs + 1) * sizeof(*index->dirfirst))) == NULL)
+		return -1;
+	for (i = d = 0; d <= index->hdr->ndirs; d++) {
+		while (i < index->hdr->nentries && index->entries[i].dir < d)
+			i++;
+		index->dirfirst[d] = i;
+	}
+	return 0;
+}
+
+/*
+ * Add an icon directory.  Its entries are copied from the old index if
+ * the directory did not change since, and read from the directory if it
+ * did, so only changed directories are listed again.
+ */
+static void
+adddir(struct Builder *b, struct IconIndex *old, const char *path,
+       size_t theme, struct ThemeDir *td)
+{
+	struct IndexDir *dir;
+	uint32_t i, j;
+
+	if ((dir = grow(b->dirs, &b->dircap, b->ndirs, sizeof(*b->dirs))) == NULL) {
+		b->nomem = 1;
+		return;
+	}
+	b->dirs = dir;
+	dir = &b->dirs[b->ndirs++];
+	dir->mtime = getmtime(path);
+	dir->path = addstring(b, path);
+	dir->theme = theme;
+	dir->type = td != NULL ? td->type : DirFallback;
+	dir->size = td != NULL ? td->size : 0;
+	dir->minsize = td != NULL ? td->minsize : 0;
+	dir->maxsize = td != NULL ? td->maxsize : 0;
+	dir->threshold = td != NULL ? td->threshold : 0;
+	if (dir->mtime == NOTIME)
+		return;
+	if (old != NULL) {
+		for (i = 0; i < old->hdr->ndirs; i++) {
+			if (old->dirs[i].mtime != dir->mtime ||
+			    strcmp(old->strings + old->dirs[i].path, path) != 0)
+				continue;
+			for (j = old->dirfirst[i]; j < old->dirfirst[i + 1]; j++)
+				addentry(b, old->strings + old->entries[j].name,
+				         b->ndirs - 1, old->entries[j].ext);
+			return;
+		}
+	}
+	listdir(b, path);
+}
+
+/* add the directories of the themes in the inheritance chain of name */
+static void
+addthemes(struct Builder *b, struct IconIndex *old, const char *name)
+{
+	struct Theme theme;
+	struct ThemeDir *td;
+	char path[PATH_MAX];
+	char *chain[MAXTHEMES];
+	char *bases[MAXBASES];
+	char *list, *s, *last;
+	size_t nchain, nbases, npixmaps, i, j, k;
+	int n;
+
+	if ((n = getbases(bases, &npixmaps)) == -1) {
+		b->nomem = 1;
+		return;
+	}
+	nbases = n;
+
+	/* new themes are found by the change of their base directories */
+	for (i = 0; i < nbases; i++)
+		addfile(b, bases[i]);
+	nchain = 0;
+	if (addtheme(chain, &nchain, name) == -1)
+		b->nomem = 1;
+	for (i = 0; i < nchain && !b->nomem; i++) {
+		memset(&theme, 0, sizeof(theme));
+		for (j = 0; j < nbases; j++) {
+			snprintf(path, sizeof(path), "%s/%s/index.theme", bases[j], chain[i]);
+			addfile(b, path);
+			if (theme.directories == NULL)
+				parsetheme(&theme, path);
+		}
+		if (theme.nomem)
+			b->nomem = 1;
+		if (theme.inherits != NULL) {
+			if ((list = estrdup(theme.inherits)) == NULL)
+				b->nomem = 1;
+			for (s = list ? strtok_r(list, ",", &last) : NULL; s != NULL;
+			     s = strtok_r(NULL, ",", &last))
+				if (addtheme(chain, &nchain, s) == -1)
+					b->nomem = 1;
+			free(list);
+		}
+		if (i == nchain - 1 && addtheme(chain, &nchain, "hicolor") == -1)
+			b->nomem = 1;
+		if (theme.directories != NULL) {
+			if ((list = estrdup(theme.directories)) == NULL)
+				b->nomem = 1;
+			for (s = list ? strtok_r(list, ",", &last) : NULL; s != NULL;
+			     s = strtok_r(NULL, ",", &last)) {
+				if ((td = getthemedir(&theme, s)) == NULL) {
+					b->nomem = 1;
+					break;
+				}
+				if (td->scale != 1 || td->size == 0)
+					continue;
+				for (k = 0; k < nbases; k++) {
+					snprintf(path, sizeof(path), "%s/%s/%s", bases[k], chain[i], s);
+					adddir(b, old, path, i, td);
+				}
+			}
+			free(list);
+		}
+		freetheme(&theme);
+	}
+
+	/* unthemed icons come after every theme */
+	for (i = 0; i < npixmaps && !b->nomem; i++)
+		adddir(b, old, bases[nbases + i], nchain, NULL);
+	freelist(chain, nchain);
+	freelist(bases, nbases + npixmaps);
+}
+
+/* lay out the index built by b into a buffer; return NULL on error */
+static struct IconIndex *
+buildindex(struct Builder *b)
+{
+	struct IconIndex *index;
+	struct IndexHeader hdr;
+	uint32_t *buckets;
+	uint32_t h;
+	size_t i;
+	char *p;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, INDEXMAGIC, sizeof(hdr.magic));
+	hdr.nfiles = b->nfiles;
+	hdr.ndirs = b->ndirs;
+	hdr.nentries = b->nentries;
+	for (hdr.nbuckets = 64; hdr.nbuckets < b->nentries * 2; hdr.nbuckets *= 2)
+		;
+	if (b->strsize == 0)
+		addstring(b, "");
+	hdr.strsize = b->strsize;
+
+	/* chain the entries of each bucket, keeping the order they were added */
+	if (b->nomem || (buckets = erealloc(NULL, hdr.nbuckets * sizeof(*buckets))) == NULL)
+		return NULL;
+	for (i = 0; i < hdr.nbuckets; i++)
+		buckets[i] = NOENTRY;
+	for (i = b->nentries; i-- > 0; ) {
+		h = hashname(b->strings + b->entries[i].name) & (hdr.nbuckets - 1);
+		b->entries[i].next = buckets[h];
+		buckets[h] = i;
+	}
+
+	if ((index = erealloc(NULL, sizeof(*index))) == NULL) {
+		free(buckets);
+		return NULL;
+	}
+	index->size = sizeof(hdr) + b->nfiles * sizeof(*b->files) +
+	              b->ndirs * sizeof(*b->dirs) + b->nentries * sizeof(*b->entries) +
+	              hdr.nbuckets * sizeof(*buckets) + b->strsize;
+	if ((index->buf = p = erealloc(NULL, index->size)) == NULL) {
+		free(buckets);
+		free(index);
+		return NULL;
+	}
+	index->mapped = 0;
+	index->dirfirst = NULL;
+	memcpy(p, &hdr, sizeof(hdr));
+	p += sizeof(hdr);
+	memcpy(p, b->files, b->nfiles * sizeof(*b->files));
+	p += b->nfiles * sizeof(*b->files);
+	memcpy(p, b->dirs, b->ndirs * sizeof(*b->dirs));
+	p += b->ndirs * sizeof(*b->dirs);
+	memcpy(p, b->entries, b->nentries * sizeof(*b->entries));
+	p += b->nentries * sizeof(*b->entries);
+	memcpy(p, buckets, hdr.nbuckets * sizeof(*buckets));
+	p += hdr.nbuckets * sizeof(*buckets);
+	memcpy(p, b->strings, b->strsize);
+	free(buckets);
+	setindex(index);
+	return index;
+}
+
+/* replace the index file atomically */
+static void
+writeindex(struct IconIndex *index, const char *path)
+{
+	char tmp[PATH_MAX];
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp))
+		return;
+	if ((fd = mkstemp(tmp)) == -1) {
+		warn("%s", tmp);
+		return;
+	}
+	if (write(fd, index->buf, index->size) != (ssize_t)index->size ||
+	    close(fd) == -1 || rename(tmp, path) == -1) {
+		warn("%s", path);
+		unlink(tmp);
+	}
+}
+
+/*
+ * Get the path of file name in the cache directory, creating the
+ * directory; return -1 if there is none or the path does not fit.
+ */
+int
+getcachepath(char *path, size_t size, const char *name)
+{
+	char *s, *home;
+	int n;
+
+	if ((s = getenv("XDG_CACHE_HOME")) != NULL && *s != '\0')
+		n = snprintf(path, size, "%s", s);
+	else if ((home = getenv("HOME")) != NULL)
+		n = snprintf(path, size, "%s/.cache", home);
+	else
+		return -1;
+	if (n < 0 || (size_t)n >= size)
+		return -1;
+	mkdir(path, 0755);
+	if (snprintf(path + n, size - n, "/" PROGNAME) >= (int)(size - n))
+		return -1;
+	if (mkdir(path, 0755) == -1 && getmtime(path) == NOTIME)
+		return -1;
+	n += strlen(path + n);
+	if (snprintf(path + n, size - n, "/%s", name) >= (int)(size - n))
+		return -1;
+	return 0;
+}
+
+/*
+ * Open the index of the icons of theme.  The index is kept in the cache
+ * directory and is valid while none of the theme files and icon
+ * directories it lists change; otherwise it is rebuilt, listing again
+ * only the directories that changed.  Return NULL on error.
+ */
+struct IconIndex *
+openiconindex(const char *theme)
+{
+	struct IconIndex *index, *old;
+	struct Builder b;
+	char path[PATH_MAX];
+	char name[NAME_MAX];
+	int cached;
+
+	if (strchr(theme, '/') != NULL)
+		theme = "hicolor";
+	cached = snprintf(name, sizeof(name), "icons-%s", theme) < (int)sizeof(name) &&
+	         getcachepath(path, sizeof(path), name) == 0;
+	old = cached ? readindex(path) : NULL;
+	if (old != NULL && !isstale(old))
+		return old;
+	if (old != NULL && indexdirs(old) == -1) {
+		closeiconindex(old);
+		old = NULL;
+	}
+	memset(&b, 0, sizeof(b));
+	addthemes(&b, old, theme);
+	index = buildindex(&b);
+	free(b.files);
+	free(b.dirs);
+	free(b.entries);
+	free(b.strings);
+	closeiconindex(old);
+	if (cached && index != NULL)
+		writeindex(index, path);
+	return index;
+}
+
+/* distance from size to the sizes of icons in dir */
+static int
+sizedistance(struct IndexDir *dir, int size)
+{
+	switch (dir->type) {
+	case DirFixed:
+		return abs(dir->size - size);
+	case DirScalable:
+		if (size < dir->minsize)
+			return dir->minsize - size;
+		if (size > dir->maxsize)
+			return size - dir->maxsize;
+		return 0;
+	case DirThreshold:
+		if (size < dir->size - dir->threshold)
+			return dir->minsize - size;
+		if (size > dir->size + dir->threshold)
+			return size - dir->maxsize;
+		return 0;
+	}
+	return 0;
+}
+
+/*
+ * Find the icon called name, from the first theme of the inheritance
+ * chain that has it, in the size closest to size; return its path, to
+ * be freed by the caller, or NULL if there is no such icon.
+ */
+char *
+findicon(struct IconIndex *index, const char *name, int size)
+{
+	struct IndexEntry *e, *best;
+	struct IndexDir *dir, *bestdir;
+	uint32_t i;
+	int dist, bestdist;
+	char *path;
+	size_t len;
+
+	if (index == NULL)
+		return NULL;
+	best = NULL;
+	bestdir = NULL;
+	bestdist = 0;
+	i = index->buckets[hashname(name) & (index->hdr->nbuckets - 1)];
+	for (; i != NOENTRY; i = e->next) {
+		e = &index->entries[i];
+		if (strcmp(index->strings + e->name, name) != 0)
+			continue;
+		dir = &index->dirs[e->dir];
+		dist = sizedistance(dir, size);
+		if (best == NULL || dir->theme < bestdir->theme ||
+		    (dir->theme == bestdir->theme && (dist < bestdist ||
+		    (dist == bestdist && e->ext < best->ext)))) {
+			best = e;
+			bestdir = dir;
+			bestdist = dist;
+		}
+	}
+	if (best == NULL)
+		return NULL;
+	len = strlen(index->strings + bestdir->path) + strlen(name) +
+	      strlen(extensions[best->ext]) + 2;
+	if ((path = erealloc(NULL, len)) == NULL)
+		return NULL;
+	snprintf(path, len, "%s/%s%s", index->strings + bestdir->path, name,
+	         extensions[best->ext]);
+	return path;
+}
+
+void
+closeiconindex(struct IconIndex *index)
+{
+	if (index == NULL)
+		return;
+	if (index->mapped)
+		munmap(index->buf, index->size);
+	else
+		free(index->buf);
+	free(index->dirfirst);
+	free(index);
+}
@@ -0,0 +1,3071 @@
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
+#include <X11/Xutil.h>
+#include <X11/XKBlib.h>
+#include <X11/Xft/Xft.h>
+#include <X11/extensions/shape.h>
+#include <X11/extensions/Xpresent.h>
+#include <xcb/xcb.h>
+#include <xcb/xinerama.h>
+#include <Imlib2.h>
+#include "libpmenu.h"
+#include "pmenu.h"
+
+#include "config.h"
+
+/* call strdup, warning on error; the library never exits its host */
+static char *
+estrdup(const char *s)
+{
+	char *t;
+
+	if ((t = strdup(s)) == NULL)
+		warn("strdup");
+	return t;
+}
+
+/* call malloc, warning on error */
+static void *
+emalloc(size_t size)
+{
+	void *p;
+
+	if ((p = malloc(size)) == NULL)
+		warn("malloc");
+	return p;
+}
+
+/* allocate the colors of the draw context, looking up named colors at once */
+static int
+alloccolors(struct PMenu *pm)
+{
+	struct {
+		const char *name;
+		XftColor *color;
+		xcb_lookup_color_cookie_t cookie;
+	} colors[] = {
+		{ pm->config.background_color,    &pm->dc.normal[ColorBG],   { 0 } },
+		{ pm->config.foreground_color,    &pm->dc.normal[ColorFG],   { 0 } },
+		{ pm->config.selbackground_color, &pm->dc.selected[ColorBG], { 0 } },
+		{ pm->config.selforeground_color, &pm->dc.selected[ColorFG], { 0 } },
+		{ pm->config.separator_color,     &pm->dc.separator,         { 0 } },
+		{ pm->config.border_color,        &pm->dc.border,            { 0 } },
+	};
+	xcb_lookup_color_reply_t *reply;
+	xcb_generic_error_t *error;
+	XRenderColor rcolor;
+	XColor xcolor;
+	size_t i;
+
+	/* send the lookup of every named color before waiting for any reply */
+	for (i = 0; i < LEN(colors); i++)
+		if (colors[i].name[0] != '#') {
+			colors[i].cookie = xcb_lookup_color(pm->xconn, pm->colormap,
+			                                    strlen(colors[i].name),
+			                                    colors[i].name);
+			pm->xcbbytes += XCBBYTES(xcb_lookup_color_request_t, strlen(colors[i].name));
+		}
+
+	for (i = 0; i < LEN(colors); i++)
+		if (colors[i].name[0] != '#') {
+			pm->roundtrips++;
+			break;
+		}
+	for (i = 0; i < LEN(colors); i++) {
+		if (colors[i].name[0] == '#') {
+			/* XParseColor() parses "#RRGGBB" without a round trip */
+			if (!XParseColor(pm->dpy, pm->colormap, colors[i].name, &xcolor))
+				goto error;
+		} else {
+			reply = xcb_lookup_color_reply(pm->xconn, colors[i].cookie, &error);
+			if (reply == NULL) {
+				free(error);
+				goto error;
+			}
+			xcolor.red = reply->exact_red;
+			xcolor.green = reply->exact_green;
+			xcolor.blue = reply->exact_blue;
+			free(reply);
+		}
+		rcolor.red = xcolor.red;
+		rcolor.green = xcolor.green;
+		rcolor.blue = xcolor.blue;
+		rcolor.alpha = 0xFFFF;
+		if (!XftColorAllocValue(pm->dpy, pm->visual, pm->colormap, &rcolor, colors[i].color))
+			goto error;
+	}
+	return 0;
+
+error:
+	warnx("could not allocate color: %s", colors[i].name);
+	while (i-- > 0)
+		XftColorFree(pm->dpy, pm->visual, pm->colormap, colors[i].color);
+	return -1;
+}
+
+/* free colors of the drawing context */
+static void
+cleancolors(struct PMenu *pm)
+{
+	XftColorFree(pm->dpy, pm->visual, pm->colormap, &pm->dc.normal[ColorBG]);
+	XftColorFree(pm->dpy, pm->visual, pm->colormap, &pm->dc.normal[ColorFG]);
+	XftColorFree(pm->dpy, pm->visual, pm->colormap, &pm->dc.selected[ColorBG]);
+	XftColorFree(pm->dpy, pm->visual, pm->colormap, &pm->dc.selected[ColorFG]);
+	XftColorFree(pm->dpy, pm->visual, pm->colormap, &pm->dc.separator);
+	XftColorFree(pm->dpy, pm->visual, pm->colormap, &pm->dc.border);
+}
+
+/* forget the fontconfig matches from the pattern n on; the fonts stay open */
+static void
+forgetfonts(struct FontCache *fc, size_t n)
+{
+	size_t i;
+
+	for (i = n; i < fc->npatterns; i++)
+		free(fc->patterns[i]);
+	fc->npatterns = n;
+	if (fc->nconfig > n)
+		fc->nconfig = n;
+	for (i = 0; i < fc->nwatched; i++)
+		free(fc->watched[i]);
+	fc->nwatched = 0;
+	fc->nranges = 0;
+	fc->dirty = 1;
+}
+
+/* free the fontconfig matches; the fonts stay open */
+static void
+freefontcache(struct FontCache *fc)
+{
+	forgetfonts(fc, 0);
+	free(fc->key);
+	free(fc->patterns);
+	free(fc->open);
+	free(fc->ranges);
+	free(fc->watched);
+	free(fc->mtimes);
+	memset(fc, 0, sizeof *fc);
+}
+
+/* grow the arrays of fc to n elements; return -1 on error, keeping them as they were */
+static int
+growfontcache(struct FontCache *fc, size_t n)
+{
+	char **patterns;
+	XftFont **open;
+
+	if ((patterns = realloc(fc->patterns, n * sizeof *fc->patterns)) == NULL) {
+		warn("realloc");
+		return -1;
+	}
+	fc->patterns = patterns;
+	if ((open = realloc(fc->open, n * sizeof *fc->open)) == NULL) {
+		warn("realloc");
+		return -1;
+	}
+	fc->open = open;
+	return 0;
+}
+
+/* add a matched pattern, which is freed on error; return its index, or -1 on error */
+static int
+appendfontpattern(struct FontCache *fc, char *unparsed)
+{
+	size_t i = fc->npatterns;
+
+	if (unparsed == NULL || growfontcache(fc, i + 1) == -1) {
+		free(unparsed);
+		fc->nomem = 1;
+		return -1;
+	}
+	fc->patterns[i] = unparsed;
+	fc->open[i] = NULL;
+	return fc->npatterns++;
+}
+
+/* add a matched fallback pattern, unless it is already there; return its index, or -1 on error */
+static int
+addfontpattern(struct FontCache *fc, char *unparsed)
+{
+	size_t i;
+
+	for (i = fc->nconfig; i < fc->npatterns; i++) {
+		if (strcmp(fc->patterns[i], unparsed) == 0) {
+			free(unparsed);
+			return i;
+		}
+	}
+	return appendfontpattern(fc, unparsed);
+}
+
+/* append a range of code points of a font; return -1 on error */
+static int
+appendfontrange(struct FontCache *fc, FcChar32 first, FcChar32 last, int font)
+{
+	struct FontRange *ranges;
+
+	if ((ranges = realloc(fc->ranges, (fc->nranges + 1) * sizeof *fc->ranges)) == NULL) {
+		warn("realloc");
+		fc->nomem = 1;
+		return -1;
+	}
+	fc->ranges = ranges;
+	fc->ranges[fc->nranges].first = first;
+	fc->ranges[fc->nranges].last = last;
+	fc->ranges[fc->nranges++].font = font;
+	return 0;
+}
+
+/*
+ * Remember the font of a code point, extending an adjacent range of the
+ * same font; return -1 on error.
+ */
+static int
+addfontrange(struct FontCache *fc, FcChar32 ucode, int font)
+{
+	struct FontRange *r;
+	size_t i;
+
+	fc->dirty = 1;
+	for (i = 0; i < fc->nranges; i++) {
+		r = &fc->ranges[i];
+		if (r->font != font)
+			continue;
+		if (r->last + 1 == ucode) {
+			r->last = ucode;
+			return 0;
+		}
+		if (r->first == ucode + 1) {
+			r->first = ucode;
+			return 0;
+		}
+	}
+	return appendfontrange(fc, ucode, ucode, font);
+}
+
+static struct FontRange *
+findfontrange(struct FontCache *fc, FcChar32 ucode)
+{
+	size_t i;
+
+	for (i = 0; i < fc->nranges; i++)
+		if (BETWEEN(ucode, fc->ranges[i].first, fc->ranges[i].last))
+			return &fc->ranges[i];
+	return NULL;
+}
+
+/* add a file fontconfig depends on; return -1 on error */
+static int
+addwatched(struct FontCache *fc, const char *path, int64_t mtime)
+{
+	char **watched;
+	int64_t *mtimes;
+
+	if ((watched = realloc(fc->watched, (fc->nwatched + 1) * sizeof *fc->watched)) == NULL)
+		goto error;
+	fc->watched = watched;
+	if ((mtimes = realloc(fc->mtimes, (fc->nwatched + 1) * sizeof *fc->mtimes)) == NULL)
+		goto error;
+	fc->mtimes = mtimes;
+	if ((fc->watched[fc->nwatched] = strdup(path)) == NULL)
+		goto error;
+	fc->mtimes[fc->nwatched++] = mtime;
+	return 0;
+
+error:
+	warn("realloc");
+	fc->nomem = 1;
+	return -1;
+}
+
+/* watch the fontconfig configuration files and font directories for changes */
+static void
+watchfontconfig(struct FontCache *fc)
+{
+	FcStrList *list;
+	FcChar8 *s;
+
+	if ((list = FcConfigGetConfigFiles(NULL)) != NULL) {
+		while ((s = FcStrListNext(list)) != NULL && !fc->nomem)
+			addwatched(fc, (char *)s, getmtime((char *)s));
+		FcStrListDone(list);
+	}
+	if ((list = FcConfigGetFontDirs(NULL)) != NULL) {
+		while ((s = FcStrListNext(list)) != NULL && !fc->nomem)
+			addwatched(fc, (char *)s, getmtime((char *)s));
+		FcStrListDone(list);
+	}
+}
+
+/* get what fonts are matched for: the font string and the Xft resources */
+static char *
+getfontkey(struct PMenu *pm, const char *font)
+{
+	static const char *resources[] = {
+		"dpi", "antialias", "hinting", "hintstyle", "rgba", "lcdfilter",
+		"autohint", "embolden", "scale",
+	};
+	char buf[BUFSIZ];
+	const char *val;
+	size_t i, n;
+
+	n = snprintf(buf, sizeof buf, "%s\t%dx%d/%dx%d", font,
+	             DisplayWidth(pm->dpy, pm->screen), DisplayHeight(pm->dpy, pm->screen),
+	             DisplayWidthMM(pm->dpy, pm->screen), DisplayHeightMM(pm->dpy, pm->screen));
+	for (i = 0; i < LEN(resources) && n < sizeof buf; i++) {
+		val = XGetDefault(pm->dpy, "Xft", resources[i]);
+		n += snprintf(buf + n, sizeof buf - n, "\t%s", val ? val : "");
+	}
+	for (i = 0; buf[i] != '\0'; i++)
+		if (buf[i] == '\n')
+			buf[i] = ' ';
+	return estrdup(buf);
+}
+
+/* get the path of the font cache of the key */
+static int
+getfontcachepath(struct FontCache *fc, char *path, size_t size)
+{
+	char name[64];
+	uint64_t h;
+	char *s;
+
+	h = 0xCBF29CE484222325;
+	for (s = fc->key; *s != '\0'; s++)
+		h = (h ^ (unsigned char)*s) * 0x100000001B3;
+	snprintf(name, sizeof name, "fonts-%016llx", (unsigned long long)h);
+	return getcachepath(path, size, name);
+}
+
+/*
+ * Read the fontconfig matches of a previous run.  Each line of the file
+ * is one of
+ *      K key
+ *      W mtime path            a file or directory fontconfig depends on
+ *      P pattern               a match, unparsed
+ *      C n                     the number of configured fonts
+ *      R first last font       the fallback font of a range of code points
+ * The matches are valid while the key is the same and no file changed.
+ */
+static int
+readfontcache(struct FontCache *fc, const char *path)
+{
+	FILE *fp;
+	char buf[BUFSIZ * 2];
+	unsigned long first, last;
+	long long mtime;
+	size_t n;
+	int font, ret = -1;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	if (fgets(buf, sizeof buf, fp) == NULL || strcmp(buf, FONTCACHEMAGIC) != 0)
+		goto done;
+	while (fgets(buf, sizeof buf, fp) != NULL) {
+		buf[strcspn(buf, "\n")] = '\0';
+		if (buf[0] != '\0' && buf[1] != ' ')
+			goto done;
+		switch (buf[0]) {
+		case 'K':
+			if (strcmp(buf + 2, fc->key) != 0)
+				goto done;
+			break;
+		case 'W':
+			if (sscanf(buf, "W %lld %n", &mtime, &font) != 1 ||
+			    getmtime(buf + font) != mtime ||
+			    addwatched(fc, buf + font, mtime) == -1)
+				goto done;
+			break;
+		case 'P':
+			if (appendfontpattern(fc, estrdup(buf + 2)) == -1)
+				goto done;
+			break;
+		case 'C':
+			if (sscanf(buf, "C %zu", &n) != 1 || n > fc->npatterns)
+				goto done;
+			fc->nconfig = n;
+			break;
+		case 'R':
+			if (sscanf(buf, "R %lu %lu %d", &first, &last, &font) != 3 ||
+			    font >= (int)fc->npatterns || first > last ||
+			    appendfontrange(fc, first, last, font) == -1)
+				goto done;
+			break;
+		}
+	}
+	ret = (fc->nwatched > 0) ? 0 : -1;
+done:
+	fclose(fp);
+	fc->dirty = 0;
+	if (ret == -1)
+		forgetfonts(fc, 0);
+	return ret;
+}
+
+/* replace the font cache file atomically */
+static void
+writefontcache(struct FontCache *fc, const char *path)
+{
+	FILE *fp;
+	char tmp[PATH_MAX];
+	size_t i;
+	int fd;
+
+	if (snprintf(tmp, sizeof tmp, "%s.XXXXXX", path) >= (int)sizeof tmp)
+		return;
+	if ((fd = mkstemp(tmp)) == -1)
+		return;
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+	fprintf(fp, "%sK %s\n", FONTCACHEMAGIC, fc->key);
+	for (i = 0; i < fc->nwatched; i++)
+		fprintf(fp, "W %lld %s\n", (long long)fc->mtimes[i], fc->watched[i]);
+	for (i = 0; i < fc->npatterns; i++)
+		fprintf(fp, "P %s\n", fc->patterns[i]);
+	fprintf(fp, "C %zu\n", fc->nconfig);
+	for (i = 0; i < fc->nranges; i++)
+		fprintf(fp, "R %lu %lu %d\n", (unsigned long)fc->ranges[i].first,
+		        (unsigned long)fc->ranges[i].last, fc->ranges[i].font);
+	if (fclose(fp) == EOF || rename(tmp, path) == -1)
+		unlink(tmp);
+}
+
+/* unparse a matched pattern, without the elements only used for matching */
+static char *
+unparsefont(FcPattern *match)
+{
+	FcPattern *copy;
+	char *s;
+
+	if ((copy = FcPatternDuplicate(match)) == NULL)
+		return NULL;
+	FcPatternDel(copy, FC_CHARSET);
+	FcPatternDel(copy, FC_LANG);
+	s = (char *)FcNameUnparse(copy);
+	FcPatternDestroy(copy);
+	return s;
+}
+
+/* open a font from a pattern matched by a previous run, without matching */
+static XftFont *
+openfontpattern(struct PMenu *pm, const char *unparsed)
+{
+	FcPattern *pattern;
+	XftFont *font;
+
+	if ((pattern = FcNameParse((FcChar8 *)unparsed)) == NULL)
+		return NULL;
+	if ((font = XftFontOpenPattern(pm->dpy, pattern)) == NULL)
+		FcPatternDestroy(pattern);
+	return font;
+}
+
+/* match a font pattern and open it, unparsing the match into unparsed_ret */
+static XftFont *
+openfontmatch(struct PMenu *pm, FcPattern *match, char **unparsed_ret)
+{
+	XftFont *font;
+
+	*unparsed_ret = unparsefont(match);
+	if ((font = XftFontOpenPattern(pm->dpy, match)) == NULL) {
+		FcPatternDestroy(match);
+		free(*unparsed_ret);
+		*unparsed_ret = NULL;
+	}
+	return font;
+}
+
+/* match a font name and open it, unparsing the match into unparsed_ret */
+static XftFont *
+openfontname(struct PMenu *pm, const char *name, char **unparsed_ret)
+{
+	FcPattern *pattern, *match;
+	XftResult result;
+
+	if ((pattern = FcNameParse((FcChar8 *)name)) == NULL)
+		return NULL;
+	match = XftFontMatch(pm->dpy, pm->screen, pattern, &result);
+	FcPatternDestroy(pattern);
+	if (match == NULL)
+		return NULL;
+	return openfontmatch(pm, match, unparsed_ret);
+}
+
+/*
+ * Parse font string and open its fonts.  The fonts are opened from the
+ * patterns matched by a previous run when the font string, the Xft
+ * resources and the fontconfig files are the same, without matching.
+ */
+static int
+parsefonts(struct PMenu *pm, const char *s)
+{
+	struct FontCache *fc = &pm->dc.fontcache;
+	const char *p;
+	char buf[1024];
+	char path[PATH_MAX];
+	char *unparsed;
+	size_t nfont = 0;
+	size_t i;
+	int cached;
+
+	pm->dc.nfonts = 1;
+	for (p = s; *p; p++)
+		if (*p == ',')
+			pm->dc.nfonts++;
+
+	if ((pm->dc.fonts = calloc(pm->dc.nfonts, sizeof *pm->dc.fonts)) == NULL) {
+		warn("calloc");
+		return -1;
+	}
+
+	if ((fc->key = getfontkey(pm, s)) == NULL)
+		goto error;
+	cached = getfontcachepath(fc, path, sizeof path) == 0 &&
+	         readfontcache(fc, path) == 0 && fc->nconfig == pm->dc.nfonts;
+	if (!cached)
+		forgetfonts(fc, 0);
+
+	p = s;
+	while (*p != '\0') {
+		i = 0;
+		while (isspace(*p))
+			p++;
+		while (i < sizeof buf && *p != '\0' && *p != ',')
+			buf[i++] = *p++;
+		if (i >= sizeof buf) {
+			warnx("font name too long");
+			goto error;
+		}
+		if (*p == ',')
+			p++;
+		buf[i] = '\0';
+		if (nfont == 0) {
+			if ((pm->dc.pattern = FcNameParse((FcChar8 *)buf)) == NULL) {
+				warnx("the first font in the cache must be loaded from a font string");
+				goto error;
+			}
+		}
+		pm->dc.fonts[nfont] = NULL;
+		if (cached && (pm->dc.fonts[nfont] = openfontpattern(pm, fc->patterns[nfont])) == NULL) {
+			/* a font of the cache is gone; match from this font on */
+			forgetfonts(fc, nfont);
+			cached = 0;
+		}
+		if (pm->dc.fonts[nfont] == NULL) {
+			if ((pm->dc.fonts[nfont] = openfontname(pm, buf, &unparsed)) == NULL) {
+				warnx("could not load font: %s", buf);
+				goto error;
+			}
+			if (appendfontpattern(fc, unparsed != NULL ? unparsed : estrdup(buf)) == -1) {
+				nfont++;
+				goto error;
+			}
+			fc->nconfig = nfont + 1;
+		}
+		fc->open[nfont] = pm->dc.fonts[nfont];
+		nfont++;
+	}
+	pm->dc.nfonts = nfont;
+	if (!cached)
+		watchfontconfig(fc);
+	return 0;
+
+error:
+	for (i = 0; i < nfont; i++)
+		XftFontClose(pm->dpy, pm->dc.fonts[i]);
+	if (pm->dc.pattern != NULL)
+		FcPatternDestroy(pm->dc.pattern);
+	free(pm->dc.fonts);
+	freefontcache(fc);
+	return -1;
+}
+
+/* init draw context */
+static int
+initdc(struct PMenu *pm)
+{
+	XGCValues values;
+	Pixmap pbg, pfg, pselbg, pselfg, separator, centerdisk;
+	unsigned long valuemask;
+
+	/* get color pixels */
+	if (alloccolors(pm) == -1)
+		return -1;
+
+	/* parse fonts */
+	if (parsefonts(pm, pm->config.font) == -1) {
+		cleancolors(pm);
+		return -1;
+	}
+
+	/* create common GC */
+	values.arc_mode = ArcPieSlice;
+	values.line_width = pm->config.separator_pixels;
+	valuemask = GCLineWidth | GCArcMode;
+	pm->dc.gc = XCreateGC(pm->dpy, pm->rootwin, valuemask, &values);
+
+	/* create color source Pictures */
+	pm->dc.pictattr.repeat = 1;
+	pm->dc.pictattr.poly_edge = PolyEdgeSmooth;
+	pbg = XCreatePixmap(pm->dpy, pm->rootwin, 1, 1, pm->depth);
+	pfg = XCreatePixmap(pm->dpy, pm->rootwin, 1, 1, pm->depth);
+	pselbg = XCreatePixmap(pm->dpy, pm->rootwin, 1, 1, pm->depth);
+	pselfg = XCreatePixmap(pm->dpy, pm->rootwin, 1, 1, pm->depth);
+	separator = XCreatePixmap(pm->dpy, pm->rootwin, 1, 1, pm->depth);
+	centerdisk = XCreatePixmap(pm->dpy, pm->rootwin, 1, 1, pm->depth);
+	pm->pie.bg = XRenderCreatePicture(pm->dpy, pbg, pm->xformat, CPRepeat, &pm->dc.pictattr);
+	pm->pie.fg = XRenderCreatePicture(pm->dpy, pfg, pm->xformat, CPRepeat, &pm->dc.pictattr);
+	pm->pie.selbg = XRenderCreatePicture(pm->dpy, pselbg, pm->xformat, CPRepeat, &pm->dc.pictattr);
+	pm->pie.selfg = XRenderCreatePicture(pm->dpy, pselfg, pm->xformat, CPRepeat, &pm->dc.pictattr);
+	pm->pie.separator = XRenderCreatePicture(pm->dpy, separator, pm->xformat, CPRepeat, &pm->dc.pictattr);
+	pm->pie.centerdisk = XRenderCreatePicture(pm->dpy, centerdisk, pm->xformat, CPRepeat, &pm->dc.pictattr);
+	XRenderFillRectangle(pm->dpy, PictOpOver, pm->pie.bg, &pm->dc.normal[ColorBG].color, 0, 0, 1, 1);
+	XRenderFillRectangle(pm->dpy, PictOpOver, pm->pie.fg, &pm->dc.normal[ColorFG].color, 0, 0, 1, 1);
+	XRenderFillRectangle(pm->dpy, PictOpOver, pm->pie.selbg, &pm->dc.selected[ColorBG].color, 0, 0, 1, 1);
+	XRenderFillRectangle(pm->dpy, PictOpOver, pm->pie.selfg, &pm->dc.selected[ColorFG].color, 0, 0, 1, 1);
+	XRenderFillRectangle(pm->dpy, PictOpOver, pm->pie.separator, &pm->dc.separator.color, 0, 0, 1, 1);
+	XRenderFillRectangle(pm->dpy, PictOpOver, pm->pie.centerdisk, &pm->dc.border.color, 0, 0, 1, 1);
+	XFreePixmap(pm->dpy, pbg);
+	XFreePixmap(pm->dpy, pfg);
+	XFreePixmap(pm->dpy, pselbg);
+	XFreePixmap(pm->dpy, pselfg);
+	XFreePixmap(pm->dpy, separator);
+	XFreePixmap(pm->dpy, centerdisk);
+	return 0;
+}
+
+/* check whether frames can be presented with the Present extension */
+static void
+initpresent(struct PMenu *pm)
+{
+	int event, error;
+
+	if (!XPresentQueryExtension(pm->dpy, &pm->presentopcode, &event, &error))
+		pm->presentopcode = 0;
+}
+
+/* count a resource made for a menu of level, with its pixel storage in the server */
+static void
+tally(struct PMenu *pm, unsigned level, int kind, int w, int h, int depth)
+{
+	struct Tally *t;
+	unsigned long bpp;
+
+	t = &pm->tally[MIN(level, TALLYLEVELS - 1)][kind];
+	t->count++;
+	if (depth == 1) {
+		t->bytes += (unsigned long)(w + 7) / 8 * h;
+		return;
+	}
+	bpp = (depth <= 8) ? 1 : (depth <= 16) ? 2 : 4;
+	t->bytes += (unsigned long)w * h * bpp;
+}
+
+/* create a transparent A8 mask of the size of the pie */
+static Picture
+createmask(struct PMenu *pm)
+{
+	static XRenderColor transparent = {0, 0, 0, 0};
+	Picture mask;
+	Pixmap pixmap;
+
+	pixmap = XCreatePixmap(pm->dpy, pm->rootwin, pm->pie.diameter, pm->pie.diameter, 8);
+	tally(pm, 0, MemShared, pm->pie.diameter, pm->pie.diameter, 8);
+	mask = XRenderCreatePicture(pm->dpy, pixmap, pm->alphaformat, CPPolyEdge, &pm->dc.pictattr);
+	XFreePixmap(pm->dpy, pixmap);   /* the picture keeps it alive */
+	XRenderFillRectangle(pm->dpy, PictOpSrc, mask, &transparent, 0, 0,
+	                     pm->pie.diameter, pm->pie.diameter);
+	return mask;
+}
+
+/* draw the center disk and the inner border, the same in every menu, into a mask */
+static void
+initcenterdisk(struct PMenu *pm)
+{
+	XGCValues values;
+	Pixmap pixmap;
+	GC gc;
+
+	pixmap = XCreatePixmap(pm->dpy, pm->rootwin, pm->pie.diameter, pm->pie.diameter, 8);
+	tally(pm, 0, MemShared, pm->pie.diameter, pm->pie.diameter, 8);
+	values.arc_mode = ArcPieSlice;
+	values.line_width = pm->config.separator_pixels;
+	values.foreground = 0;
+	gc = XCreateGC(pm->dpy, pixmap, GCArcMode | GCLineWidth | GCForeground, &values);
+	XFillRectangle(pm->dpy, pixmap, gc, 0, 0, pm->pie.diameter, pm->pie.diameter);
+	XSetForeground(pm->dpy, gc, 0xFF);
+	XFillArc(pm->dpy, pixmap, gc, pm->pie.radius - pm->pie.centerdiskradius - 1, pm->pie.radius - pm->pie.centerdiskradius - 1,
+	         2 * pm->pie.centerdiskradius + 1, 2 * pm->pie.centerdiskradius + 1, 0, 360*64);
+	if (pm->pie.border > 0)
+		XDrawArc(pm->dpy, pixmap, gc, pm->pie.radius - pm->pie.centerdiskradius, pm->pie.radius - pm->pie.centerdiskradius,
+		         2 * pm->pie.centerdiskradius, 2 * pm->pie.centerdiskradius, 0, 360*64);
+	XFreeGC(pm->dpy, gc);
+	pm->pie.centerdiskmask = XRenderCreatePicture(pm->dpy, pixmap, pm->alphaformat, 0, NULL);
+	XFreePixmap(pm->dpy, pixmap);   /* the picture keeps it alive */
+}
+
+/* setup pie */
+static void
+initpie(struct PMenu *pm)
+{
+	XGCValues values;
+	unsigned long valuemask;
+
+	/* set pie geometry */
+	pm->pie.border = pm->config.border_pixels;
+	pm->pie.diameter = pm->config.diameter_pixels;
+	pm->pie.radius = (pm->pie.diameter + 1) / 2;
+	pm->pie.fulldiameter = pm->pie.diameter + (pm->pie.border * 2);
+
+	/* set the geometry of the triangle for submenus */
+	pm->pie.triangleouter = pm->pie.radius - pm->config.triangle_distance;
+	pm->pie.triangleinner = pm->pie.radius - pm->config.triangle_distance - pm->config.triangle_width;
+	pm->pie.triangleangle = ((double)pm->config.triangle_height / 2.0) / (double)pm->pie.triangleinner;
+
+	/* set the separator beginning and end */
+	pm->pie.separatorbeg = pm->pie.radius * pm->config.separatorbeg;
+	pm->pie.separatorend = pm->pie.radius * pm->config.separatorend;
+    pm->pie.centerdiskradius = (pm->pie.radius + 1) * pm->config.centerdiskradius;
+	pm->pie.innerangle = atan(pm->config.separator_pixels / (2.0 * pm->pie.separatorbeg));
+	pm->pie.outerangle = atan(pm->config.separator_pixels / (2.0 * pm->pie.separatorend));
+
+	/* Create a simple bitmap mask (pm->depth = 1) */
+	pm->pie.clip = XCreatePixmap(pm->dpy, pm->rootwin, pm->pie.diameter, pm->pie.diameter, 1);
+	pm->pie.bounding = XCreatePixmap(pm->dpy, pm->rootwin, pm->pie.fulldiameter, pm->pie.fulldiameter, 1);
+	tally(pm, 0, MemShared, pm->pie.diameter, pm->pie.diameter, 1);
+	tally(pm, 0, MemShared, pm->pie.fulldiameter, pm->pie.fulldiameter, 1);
+
+	/* Create the mask GC */
+	values.background = 1;
+	values.arc_mode = ArcPieSlice;
+	valuemask = GCBackground | GCArcMode;
+	pm->pie.gc = XCreateGC(pm->dpy, pm->pie.clip, valuemask, &values);
+
+	/* clear the bitmap */
+	XSetForeground(pm->dpy, pm->pie.gc, 0);
+	XFillRectangle(pm->dpy, pm->pie.clip, pm->pie.gc, 0, 0, pm->pie.diameter, pm->pie.diameter);
+	XFillRectangle(pm->dpy, pm->pie.bounding, pm->pie.gc, 0, 0, pm->pie.fulldiameter, pm->pie.fulldiameter);
+
+	/* create round shape */
+	XSetForeground(pm->dpy, pm->pie.gc, 1);
+	XFillArc(pm->dpy, pm->pie.clip, pm->pie.gc, 0, 0,
+	         pm->pie.diameter, pm->pie.diameter, 0, 360*64);
+	XFillArc(pm->dpy, pm->pie.bounding, pm->pie.gc, 0, 0,
+	         pm->pie.fulldiameter, pm->pie.fulldiameter, 0, 360*64);
+
+	initcenterdisk(pm);
+}
+
+/* free a slice, but not its submenu */
+static void
+freeslice(struct Slice *slice)
+{
+	if (slice->label != slice->output)
+		free(slice->label);
+	free(slice->output);
+	free(slice->file);
+	free(slice->ucs);
+	free(slice);
+}
+
+/* allocate an slice; return NULL on error */
+static struct Slice *
+allocslice(const char *label, const char *output, const char *file)
+{
+	struct Slice *slice;
+
+	if ((slice = emalloc(sizeof *slice)) == NULL)
+		return NULL;
+	slice->label = label ? estrdup(label) : NULL;
+	slice->output = (label == output) ? slice->label : output ? estrdup(output) : NULL;
+	slice->file = file ? estrdup(file) : NULL;
+	slice->ucs = NULL;
+	if ((label != NULL && slice->label == NULL) ||
+	    (output != NULL && slice->output == NULL) ||
+	    (file != NULL && slice->file == NULL)) {
+		freeslice(slice);
+		return NULL;
+	}
+	slice->y = 0;
+	slice->ucslen = 0;
+	slice->next = NULL;
+	slice->submenu = NULL;
+	slice->iconw = slice->iconh = 0;
+
+	return slice;
+}
+
+/* allocate a menu, whose X objects are created later by initmenu(); return NULL on error */
+static struct Menu *
+allocmenu(struct Menu *parent, struct Slice *list, unsigned level)
+{
+	struct Menu *menu;
+
+	if ((menu = emalloc(sizeof *menu)) == NULL)
+		return NULL;
+
+	/* set menu variables */
+	menu->parent = parent;
+	menu->list = list;
+	menu->caller = NULL;
+	menu->selected = NULL;
+	menu->nslices = 0;
+	menu->x = 0;    /* calculated by setupmenu() */
+	menu->y = 0;    /* calculated by setupmenu() */
+	menu->level = level;
+	menu->laidout = 0;
+	menu->drawn = 0;
+	menu->win = None;
+	menu->atlas = None;
+	menu->serial = 0;
+	menu->msc = 0;
+
+	return menu;
+}
+
+/* create the window and pixmap of a menu, at the position given by placemenu() */
+static void
+initmenu(struct PMenu *pm, struct Menu *menu)
+{
+	XSetWindowAttributes swa;
+	XClassHint classh = {PROGNAME, PROGNAME};
+	XSizeHints sizeh;
+
+	/* create menu window */
+	swa.override_redirect = True;
+	swa.background_pixel = pm->dc.normal[ColorBG].pixel;
+	swa.border_pixel = pm->dc.border.pixel;
+	swa.save_under = True;  /* pop-up windows should save_under*/
+	swa.event_mask = ExposureMask | KeyPressMask | ButtonPressMask | ButtonReleaseMask
+	               | PointerMotionMask | EnterWindowMask | LeaveWindowMask;
+	menu->win = XCreateWindow(pm->dpy, pm->rootwin, menu->x, menu->y, pm->pie.diameter, pm->pie.diameter, pm->pie.border,
+	                          CopyFromParent, CopyFromParent, CopyFromParent,
+	                          CWOverrideRedirect | CWBackPixel |
+	                          CWBorderPixel | CWEventMask | CWSaveUnder,
+	                          &swa);
+
+	XShapeCombineMask(pm->dpy, menu->win, ShapeClip, 0, 0, pm->pie.clip, ShapeSet);
+	XShapeCombineMask(pm->dpy, menu->win, ShapeBounding, -pm->pie.border, -pm->pie.border, pm->pie.bounding, ShapeSet);
+
+	/* set window manager hints */
+	sizeh.flags = USPosition | PMaxSize | PMinSize;
+	sizeh.min_width = sizeh.max_width = pm->pie.diameter;
+	sizeh.min_height = sizeh.max_height = pm->pie.diameter;
+	XSetWMProperties(pm->dpy, menu->win, NULL, NULL, NULL, 0, &sizeh, NULL, &classh);
+	if (pm->presentopcode != 0)
+		XPresentSelectInput(pm->dpy, menu->win, PresentCompleteNotifyMask);
+
+	/* create pixmap and picture */
+	menu->pixmap = XCreatePixmap(pm->dpy, menu->win, pm->pie.diameter, pm->pie.diameter, pm->depth);
+	tally(pm, menu->level, MemWindow, 0, 0, 0);
+	tally(pm, menu->level, MemMenu, pm->pie.diameter, pm->pie.diameter, pm->depth);
+	menu->picture = XRenderCreatePicture(pm->dpy, menu->pixmap, pm->xformat, CPPolyEdge | CPRepeat, &pm->dc.pictattr);
+	menu->draw = XftDrawCreate(pm->dpy, menu->pixmap, pm->visual, pm->colormap);
+}
+
+/* load image from file and scale it to size; return the image and its size, or NULL */
+static Imlib_Image
+loadicon(struct PMenu *pm, const char *file, int size, int *width_ret, int *height_ret)
+{
+	Imlib_Image icon;
+	Imlib_Load_Error errcode;
+	const char *errstr;
+	char *path;
+	int width;
+	int height;
+
+	PROBE2(loadicon, file, size);
+	if (*file == '\0') {
+		warnx("could not load icon (file name is blank)");
+		return NULL;
+	}
+
+	/* a name without slashes is an icon of the icon theme */
+	path = NULL;
+	if (strchr(file, '/') == NULL) {
+		if (pm->icons == NULL)
+			pm->icons = openiconindex(pm->config.icon_theme);
+		if ((path = findicon(pm->icons, file, size)) == NULL) {
+			warnx("could not find icon in theme %s: %s", pm->config.icon_theme, file);
+			return NULL;
+		}
+		file = path;
+	}
+	imlib_context_push(pm->imlib);
+	icon = imlib_load_image_with_error_return(file, &errcode);
+	if (icon == NULL) {
+		switch (errcode) {
+		case IMLIB_LOAD_ERROR_FILE_DOES_NOT_EXIST:
+			errstr = "file does not exist";
+			break;
+		case IMLIB_LOAD_ERROR_FILE_IS_DIRECTORY:
+			errstr = "file is directory";
+			break;
+		case IMLIB_LOAD_ERROR_PERMISSION_DENIED_TO_READ:
+		case IMLIB_LOAD_ERROR_PERMISSION_DENIED_TO_WRITE:
+			errstr = "permission denied";
+			break;
+		case IMLIB_LOAD_ERROR_NO_LOADER_FOR_FILE_FORMAT:
+			errstr = "unknown file format";
+			break;
+		case IMLIB_LOAD_ERROR_PATH_TOO_LONG:
+			errstr = "path too long";
+			break;
+		case IMLIB_LOAD_ERROR_PATH_COMPONENT_NON_EXISTANT:
+		case IMLIB_LOAD_ERROR_PATH_COMPONENT_NOT_DIRECTORY:
+		case IMLIB_LOAD_ERROR_PATH_POINTS_OUTSIDE_ADDRESS_SPACE:
+			errstr = "improper path";
+			break;
+		case IMLIB_LOAD_ERROR_TOO_MANY_SYMBOLIC_LINKS:
+			errstr = "too many symbolic links";
+			break;
+		case IMLIB_LOAD_ERROR_OUT_OF_MEMORY:
+			errstr = "out of memory";
+			break;
+		case IMLIB_LOAD_ERROR_OUT_OF_FILE_DESCRIPTORS:
+			errstr = "out of file descriptors";
+			break;
+		default:
+			errstr = "unknown error";
+			break;
+		}
+		warnx("could not load icon (%s): %s", errstr, file);
+		imlib_context_pop();
+		free(path);
+		return NULL;
+	}
+	free(path);
+
+	imlib_context_set_image(icon);
+
+	width = imlib_image_get_width();
+	height = imlib_image_get_height();
+
+	if (width > height) {
+		*width_ret = size;
+		*height_ret = (height * size) / width;
+	} else {
+		*width_ret = (width * size) / height;
+		*height_ret = size;
+	}
+
+	icon = imlib_create_cropped_scaled_image(0, 0, width, height,
+	                                         *width_ret, *height_ret);
+	imlib_free_image();
+	imlib_context_pop();
+
+	return icon;
+}
+
+/* get next utf8 char from s return its codepoint and set next_ret to pointer to end of character */
+static FcChar32
+getnextutf8char(const char *s, const char **next_ret)
+{
+	static const unsigned char utfbyte[] = {0x80, 0x00, 0xC0, 0xE0, 0xF0};
+	static const unsigned char utfmask[] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
+	static const FcChar32 utfmin[] = {0, 0x00,  0x80,  0x800,  0x10000};
+	static const FcChar32 utfmax[] = {0, 0x7F, 0x7FF, 0xFFFF, 0x10FFFF};
+	/* 0xFFFD is the replacement character, used to represent unknown characters */
+	static const FcChar32 unknown = 0xFFFD;
+	FcChar32 ucode;         /* FcChar32 type holds 32 bits */
+	size_t usize = 0;       /* n' of bytes of the utf8 character */
+	size_t i;
+
+	*next_ret = s+1;
+
+	/* get code of first byte of utf8 character */
+	for (i = 0; i < sizeof utfmask; i++) {
+		if (((unsigned char)*s & utfmask[i]) == utfbyte[i]) {
+			usize = i;
+			ucode = (unsigned char)*s & ~utfmask[i];
+			break;
+		}
+	}
+
+	/* if first byte is a continuation byte or is not allowed, return unknown */
+	if (i == sizeof utfmask || usize == 0)
+		return unknown;
+
+	/* check the other usize-1 bytes */
+	s++;
+	for (i = 1; i < usize; i++) {
+		*next_ret = s+1;
+		/* if byte is nul or is not a continuation byte, return unknown */
+		if (*s == '\0' || ((unsigned char)*s & utfmask[0]) != utfbyte[0])
+			return unknown;
+		/* 6 is the number of relevant bits in the continuation byte */
+		ucode = (ucode << 6) | ((unsigned char)*s & ~utfmask[0]);
+		s++;
+	}
+
+	/* check if ucode is invalid or in utf-16 surrogate halves */
+	if (!BETWEEN(ucode, utfmin[usize], utfmax[usize])
+	    || BETWEEN (ucode, 0xD800, 0xDFFF))
+		return unknown;
+
+	return ucode;
+}
+
+/*
+ * Decode the UTF-8 string s into a new array of code points, setting
+ * len_ret to their number.  Invalid sequences become U+FFFD and set
+ * invalid_ret.  Blocks of ASCII are widened 16 bytes at a time.
+ * Return NULL on error.
+ */
+static FcChar32 *
+decodeutf8(const char *s, size_t *len_ret, int *invalid_ret)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	const char *next;
+	FcChar32 *ucs, *shrunk;
+	size_t len, i, n;
+
+	len = strlen(s);
+	if ((ucs = emalloc((len + 1) * sizeof *ucs)) == NULL)
+		return NULL;
+	*invalid_ret = 0;
+	for (i = n = 0; i < len; ) {
+		if (p[i] < 0x80) {
+#if defined(__SSE2__)
+			if (i + 16 <= len) {
+				__m128i v, lo, hi, zero;
+
+				v = _mm_loadu_si128((const __m128i *)(p + i));
+				if (_mm_movemask_epi8(v) == 0) {
+					zero = _mm_setzero_si128();
+					lo = _mm_unpacklo_epi8(v, zero);
+					hi = _mm_unpackhi_epi8(v, zero);
+					_mm_storeu_si128((__m128i *)(ucs + n), _mm_unpacklo_epi16(lo, zero));
+					_mm_storeu_si128((__m128i *)(ucs + n + 4), _mm_unpackhi_epi16(lo, zero));
+					_mm_storeu_si128((__m128i *)(ucs + n + 8), _mm_unpacklo_epi16(hi, zero));
+					_mm_storeu_si128((__m128i *)(ucs + n + 12), _mm_unpackhi_epi16(hi, zero));
+					i += 16;
+					n += 16;
+					continue;
+				}
+			}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+			if (i + 16 <= len) {
+				uint8x16_t v;
+				uint16x8_t lo, hi;
+
+				v = vld1q_u8(p + i);
+				if (vmaxvq_u8(v) < 0x80) {
+					lo = vmovl_u8(vget_low_u8(v));
+					hi = vmovl_u8(vget_high_u8(v));
+					vst1q_u32(ucs + n, vmovl_u16(vget_low_u16(lo)));
+					vst1q_u32(ucs + n + 4, vmovl_u16(vget_high_u16(lo)));
+					vst1q_u32(ucs + n + 8, vmovl_u16(vget_low_u16(hi)));
+					vst1q_u32(ucs + n + 12, vmovl_u16(vget_high_u16(hi)));
+					i += 16;
+					n += 16;
+					continue;
+				}
+			}
+#endif
+			ucs[n++] = p[i++];
+			continue;
+		}
+
+		/* U+FFFD decoded from anything but its own encoding is an error */
+		ucs[n] = getnextutf8char(s + i, &next);
+		if (ucs[n] == 0xFFFD && (next - (s + i) != 3 || memcmp(s + i, "\xEF\xBF\xBD", 3) != 0))
+			*invalid_ret = 1;
+		n++;
+		i = next - s;
+	}
+	if (n < len && (shrunk = realloc(ucs, (n + 1) * sizeof *ucs)) != NULL)
+		ucs = shrunk;
+	*len_ret = n;
+	return ucs;
+}
+
+/* add a fallback font to the fonts searched for code points; return -1 on error */
+static int
+adddcfont(struct PMenu *pm, XftFont *font)
+{
+	XftFont **fonts;
+
+	if ((fonts = realloc(pm->dc.fonts, (pm->dc.nfonts + 1) * sizeof *pm->dc.fonts)) == NULL) {
+		warn("realloc");
+		return -1;
+	}
+	pm->dc.fonts = fonts;
+	pm->dc.fonts[pm->dc.nfonts++] = font;
+	return 0;
+}
+
+/* get which font contains a given code point */
+static XftFont *
+getfontucode(struct PMenu *pm, FcChar32 ucode)
+{
+	struct FontCache *fc = &pm->dc.fontcache;
+	struct FontRange *range;
+	FcCharSet *fccharset = NULL;
+	FcPattern *fcpattern = NULL;
+	FcPattern *match = NULL;
+	XftFont *retfont = NULL;
+	XftResult result;
+	char *unparsed;
+	size_t i;
+	int n;
+
+	for (i = 0; i < pm->dc.nfonts; i++)
+		if (XftCharExists(pm->dpy, pm->dc.fonts[i], ucode) == FcTrue)
+			return pm->dc.fonts[i];
+
+	/* use the fallback a previous run found, if it is not open yet */
+	if ((range = findfontrange(fc, ucode)) != NULL) {
+		if (range->font < 0)
+			return pm->dc.fonts[0];
+		if (fc->open[range->font] == NULL &&
+		    (retfont = openfontpattern(pm, fc->patterns[range->font])) != NULL) {
+			if (adddcfont(pm, retfont) == -1) {
+				XftFontClose(pm->dpy, retfont);
+				return pm->dc.fonts[0];
+			}
+			fc->open[range->font] = retfont;
+			if (XftCharExists(pm->dpy, retfont, ucode) == FcTrue)
+				return retfont;
+		}
+	}
+
+	/* no open font has it; ask fontconfig for a fallback */
+	PROBE1(fontfallback, ucode);
+
+	/* create a charset containing our code point */
+	fccharset = FcCharSetCreate();
+	FcCharSetAddChar(fccharset, ucode);
+
+	/* create a pattern akin to the pm->dc.pattern but containing our charset */
+	if (fccharset) {
+		fcpattern = FcPatternDuplicate(pm->dc.pattern);
+		FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
+	}
+
+	/* find pattern matching fcpattern */
+	if (fcpattern) {
+		FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
+		FcDefaultSubstitute(fcpattern);
+		match = XftFontMatch(pm->dpy, pm->screen, fcpattern, &result);
+	}
+
+	/* if found a pattern, open its font */
+	if (match) {
+		retfont = openfontmatch(pm, match, &unparsed);
+		if (retfont && XftCharExists(pm->dpy, retfont, ucode) == FcTrue &&
+		    adddcfont(pm, retfont) == 0) {
+			if (unparsed != NULL && (n = addfontpattern(fc, unparsed)) != -1) {
+				fc->open[n] = retfont;
+				addfontrange(fc, ucode, n);
+			}
+			PROBE2(fontfallback__done, ucode, 1);
+			return retfont;
+		} else if (retfont) {
+			XftFontClose(pm->dpy, retfont);
+			free(unparsed);
+		}
+	}
+
+	/* in case no fount was found, return the first one */
+	addfontrange(fc, ucode, -1);
+	PROBE2(fontfallback__done, ucode, 0);
+	return pm->dc.fonts[0];
+}
+
+/* draw text into XftDraw, in runs of characters of the same font */
+static int
+drawtext(struct PMenu *pm, XftDraw *draw, XftColor *color, int x, int y,
+         const FcChar32 *ucs, size_t len)
+{
+	XftFont *currfont;
+	XGlyphInfo ext;
+	size_t i, j;
+	int textwidth = 0;
+
+	for (i = 0; i < len; i = j) {
+		currfont = getfontucode(pm, ucs[i]);
+		for (j = i + 1; j < len && getfontucode(pm, ucs[j]) == currfont; j++)
+			;
+
+		XftTextExtents32(pm->dpy, currfont, ucs + i, j - i, &ext);
+		textwidth += ext.xOff;
+
+		if (draw) {
+			int texty;
+
+			texty = y + (currfont->ascent - currfont->descent)/2;
+			XftDrawString32(draw, color, currfont, x, texty, ucs + i, j - i);
+			x += ext.xOff;
+		}
+	}
+
+	return textwidth;
+}
+
+/* compute the angles of menu's slices and the positions of their labels */
+static void
+layoutmenu(struct PMenu *pm, struct Menu *menu)
+{
+	struct Slice *slice;
+	double a = 0.0;
+	unsigned n = 0;
+	int textwidth;
+
+	menu->half = M_PI / menu->nslices;
+	for (slice = menu->list; slice; slice = slice->next) {
+		slice->slicen = n++;
+
+		slice->anglea = a - menu->half;
+		slice->angleb = a + menu->half;
+
+		/* get length of slice->label rendered in the font */
+		textwidth = drawtext(pm, NULL, NULL, 0, 0, slice->ucs, slice->ucslen);
+
+		/* get position of slice's label */
+		slice->labelx = pm->pie.radius + ((pm->pie.radius*2)/3 * cos(a)) - (textwidth / 2);
+		slice->labely = pm->pie.radius - ((pm->pie.radius*2)/3 * sin(a));
+
+		/* get position of submenu */
+		slice->x = pm->pie.radius + (pm->pie.diameter * (cos(a) * 0.9));
+		slice->y = pm->pie.radius - (pm->pie.diameter * (sin(a) * 0.9));
+
+		a += menu->half * 2;
+	}
+}
+
+/* upload an icon into the atlas at x, premultiplying its alpha, and free it */
+static void
+uploadicon(struct PMenu *pm, Imlib_Image icon, Pixmap atlas, GC gc, int x)
+{
+	XImage *ximage;
+	DATA32 *data;
+	uint32_t *pixels;
+	uint32_t p, a;
+	uint32_t one = 1;
+	int w, h, i;
+
+	imlib_context_push(pm->imlib);
+	imlib_context_set_image(icon);
+	w = imlib_image_get_width();
+	h = imlib_image_get_height();
+	data = imlib_image_get_data_for_reading_only();
+	if ((pixels = emalloc(w * h * sizeof *pixels)) == NULL) {
+		imlib_free_image();
+		imlib_context_pop();
+		return;
+	}
+	for (i = 0; i < w * h; i++) {
+		p = data[i];
+		a = p >> 24;
+		pixels[i] = (a << 24) |
+		            (((p >> 16 & 0xFF) * a / 0xFF) << 16) |
+		            (((p >> 8 & 0xFF) * a / 0xFF) << 8) |
+		            ((p & 0xFF) * a / 0xFF);
+	}
+	imlib_free_image();
+	imlib_context_pop();
+
+	ximage = XCreateImage(pm->dpy, pm->visual, 32, ZPixmap, 0, (char *)pixels,
+	                      w, h, 32, 0);
+	if (ximage == NULL) {
+		free(pixels);
+		return;
+	}
+
+	/* the pixels are in host order, which Xlib swaps if the server's differs */
+	ximage->byte_order = (*(unsigned char *)&one == 1) ? LSBFirst : MSBFirst;
+	XPutImage(pm->dpy, atlas, gc, ximage, 0, 0, x, 0, w, h);
+	XDestroyImage(ximage);  /* frees pixels */
+}
+
+/* get the size of the square the icons of the slices of a menu fit in */
+static int
+geticonsize(struct PMenu *pm, struct Menu *menu)
+{
+	int maxiconsize = (pm->pie.radius + 1) / 2;
+	int iconsize;
+	int xdiff, ydiff;
+
+	xdiff = pm->pie.radius * 0.5 - (pm->pie.radius * (cos(menu->half) * 0.8));
+	ydiff = pm->pie.radius * (sin(menu->half) * 0.8);
+	iconsize = sqrt(xdiff * xdiff + ydiff * ydiff);
+	return MAX(MIN(maxiconsize, iconsize), 1);
+}
+
+/*
+ * Load the icons of a menu and upload them once into its atlas, so
+ * drawmenu() composites them from the server instead of sending them
+ * again for each pixmap of the menu.
+ */
+static void
+seticons(struct PMenu *pm, struct Menu *menu)
+{
+	struct Slice *slice;
+	Imlib_Image icon;
+	Pixmap atlas;
+	GC gc;
+	double a;
+	int iconsize;           /* requested icon size */
+	int nicons = 0;
+	int x = 0;
+
+	for (slice = menu->list; slice; slice = slice->next)
+		if (slice->file != NULL)
+			nicons++;
+	if (nicons == 0)
+		return;
+
+	iconsize = geticonsize(pm, menu);
+
+	/* every icon fits in a square of iconsize */
+	atlas = XCreatePixmap(pm->dpy, menu->win, nicons * iconsize, iconsize, 32);
+	tally(pm, menu->level, MemIcons, nicons * iconsize, iconsize, 32);
+	gc = XCreateGC(pm->dpy, atlas, 0, NULL);
+	for (slice = menu->list; slice; slice = slice->next) {
+		if (slice->file == NULL)
+			continue;
+		icon = loadicon(pm, slice->file, iconsize, &slice->iconw, &slice->iconh);
+		if (icon == NULL) {
+			slice->iconw = slice->iconh = 0;
+			continue;
+		}
+		uploadicon(pm, icon, atlas, gc, x);
+		a = (slice->anglea + slice->angleb) / 2;
+		slice->atlasx = x;
+		slice->iconx = pm->pie.radius + (pm->pie.radius * (cos(a) * 0.6)) - slice->iconw / 2;
+		slice->icony = pm->pie.radius - (pm->pie.radius * (sin(a) * 0.6)) - slice->iconh / 2;
+		x += iconsize;
+	}
+	XFreeGC(pm->dpy, gc);
+	menu->atlas = XRenderCreatePicture(pm->dpy, atlas,
+	                                   XRenderFindStandardFormat(pm->dpy, PictStandardARGB32),
+	                                   0, NULL);
+	XFreePixmap(pm->dpy, atlas);    /* the picture keeps it alive */
+}
+
+/* hash n bytes into h */
+static uint64_t
+hashbytes(uint64_t h, const void *p, size_t n)
+{
+	const unsigned char *s = p;
+
+	while (n-- > 0)
+		h = (h ^ *s++) * 0x100000001B3;
+	return h;
+}
+
+static uint64_t
+hashstring(uint64_t h, const char *s)
+{
+	if (s == NULL)
+		s = "";
+	return hashbytes(h, s, strlen(s) + 1);
+}
+
+/*
+ * Get the key of the pixels of a laid out menu: a hash of its slices,
+ * of the files of its icons, of the colors, the fonts and the geometry
+ * of the pie, and of the pixel format.
+ */
+static uint64_t
+getpixelkey(struct PMenu *pm, struct Menu *menu)
+{
+	struct FontCache *fc = &pm->dc.fontcache;
+	struct Slice *slice;
+	unsigned long v[] = {
+		pm->depth, pm->visual->red_mask, pm->visual->green_mask, pm->visual->blue_mask,
+		pm->pie.diameter, pm->pie.border, pm->pie.centerdiskradius,
+		pm->pie.separatorbeg, pm->pie.separatorend,
+		pm->pie.triangleinner, pm->pie.triangleouter, pm->config.triangles,
+		pm->dc.normal[ColorBG].pixel, pm->dc.normal[ColorFG].pixel,
+		pm->dc.selected[ColorBG].pixel, pm->dc.selected[ColorFG].pixel,
+		pm->dc.border.pixel, pm->dc.separator.pixel, menu->nslices,
+	};
+	double d[] = {pm->pie.triangleangle, pm->pie.innerangle, pm->pie.outerangle};
+	int64_t mtime;
+	uint64_t h;
+	size_t i;
+	char *path;
+
+	h = hashbytes(0xCBF29CE484222325, PIXELCACHEMAGIC, 8);
+	h = hashbytes(h, v, sizeof v);
+	h = hashbytes(h, d, sizeof d);
+	h = hashstring(h, fc->key);
+	for (i = 0; i < fc->nwatched; i++) {
+		h = hashstring(h, fc->watched[i]);
+		h = hashbytes(h, &fc->mtimes[i], sizeof fc->mtimes[i]);
+	}
+	for (slice = menu->list; slice != NULL; slice = slice->next) {
+		h = hashbytes(h, slice->ucs, slice->ucslen * sizeof *slice->ucs);
+		h = hashbytes(h, &slice->ucslen, sizeof slice->ucslen);
+		h = hashstring(h, slice->submenu != NULL ? "submenu" : "");
+		if (slice->file == NULL) {
+			h = hashstring(h, NULL);
+			continue;
+		}
+		path = NULL;
+		if (strchr(slice->file, '/') == NULL) {
+			if (pm->icons == NULL)
+				pm->icons = openiconindex(pm->config.icon_theme);
+			path = findicon(pm->icons, slice->file, geticonsize(pm, menu));
+		}
+		h = hashstring(h, path != NULL ? path : slice->file);
+		mtime = getmtime(path != NULL ? path : slice->file);
+		h = hashbytes(h, &mtime, sizeof mtime);
+		free(path);
+	}
+	return h != 0 ? h : 1;
+}
+
+/* get the path of the pixel cache of the key */
+static int
+getpixelcachepath(uint64_t key, char *path, size_t size)
+{
+	char name[64];
+
+	snprintf(name, sizeof name, "pixels-%016llx", (unsigned long long)key);
+	return getcachepath(path, size, name);
+}
+
+/* check that images of the pixel format of the menus are laid out as in header */
+static int
+checkpixelformat(struct PMenu *pm, struct PixelHeader *header)
+{
+	XImage *ximage;
+	int ret;
+
+	ximage = XCreateImage(pm->dpy, pm->visual, pm->depth, ZPixmap, 0, NULL,
+	                      pm->pie.diameter, pm->pie.diameter, 32, 0);
+	if (ximage == NULL)
+		return -1;
+	ret = (header->depth == (uint32_t)pm->depth &&
+	       header->diameter == (uint32_t)pm->pie.diameter &&
+	       header->bpp == (uint32_t)ximage->bits_per_pixel &&
+	       header->bpl == (uint32_t)ximage->bytes_per_line &&
+	       header->byteorder == (uint32_t)ximage->byte_order) ? 0 : -1;
+	XDestroyImage(ximage);
+	return ret;
+}
+
+/*
+ * Map the pixels of the root menu rendered by a previous run, if they
+ * are kept and their key and format match; drawmenu() then uploads
+ * them instead of drawing.
+ */
+static int
+loadpixels(struct PMenu *pm, struct Menu *menu)
+{
+	struct PixelHeader *header;
+	struct stat st;
+	char path[PATH_MAX];
+	size_t size;
+	void *p;
+	int fd;
+
+	if (!pm->config.pixel_cache || pm->dc.fontcache.nomem)
+		return -1;
+	pm->pixels.key = getpixelkey(pm, menu);
+	if (getpixelcachepath(pm->pixels.key, path, sizeof path) == -1)
+		return -1;
+	if ((fd = open(path, O_RDONLY)) == -1)
+		return -1;
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof *header) {
+		close(fd);
+		return -1;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		return -1;
+	header = p;
+	size = 0;
+	if (memcmp(header->magic, PIXELCACHEMAGIC, sizeof header->magic) == 0 &&
+	    header->key == pm->pixels.key && header->nstates == menu->nslices + 1 &&
+	    checkpixelformat(pm, header) == 0)
+		size = sizeof *header + (size_t)header->nstates * header->bpl * header->diameter;
+	if (size == 0 || size != (size_t)st.st_size) {
+		munmap(p, st.st_size);
+		return -1;
+	}
+	pm->pixels.map = header;
+	pm->pixels.size = size;
+	return 0;
+}
+
+/* upload the cached pixels of a state of the root menu into pixmap */
+static void
+putpixels(struct PMenu *pm, unsigned state, Drawable pixmap)
+{
+	struct PixelHeader *header = pm->pixels.map;
+	XImage *ximage;
+	char *data;
+
+	data = (char *)(header + 1) + (size_t)state * header->bpl * header->diameter;
+	ximage = XCreateImage(pm->dpy, pm->visual, pm->depth, ZPixmap, 0, data,
+	                      header->diameter, header->diameter, 32, header->bpl);
+	if (ximage == NULL)
+		return;
+	XPutImage(pm->dpy, pixmap, pm->dc.gc, ximage, 0, 0, 0, 0,
+	          header->diameter, header->diameter);
+	ximage->data = NULL;    /* the pixels belong to the mapping */
+	XDestroyImage(ximage);
+}
+
+/* lay out the slices of a menu the first time they are needed */
+static void
+setuplayout(struct PMenu *pm, struct Menu *menu)
+{
+	if (menu->laidout)
+		return;
+	layoutmenu(pm, menu);
+	menu->laidout = 1;
+}
+
+/*
+ * Set up a menu the first time it is mapped: lay it out, load its icons
+ * and create its window and pixmaps.  Menus are set up on demand, so the
+ * startup cost depends on the root menu rather than on the whole tree.
+ */
+static void
+setupmenu(struct PMenu *pm, struct Menu *menu)
+{
+	struct Slice *slice;
+
+	if (menu->win != None)
+		return;
+	setuplayout(pm, menu);
+	initmenu(pm, menu);
+	if (menu != pm->rootmenu || loadpixels(pm, menu) == -1)
+		seticons(pm, menu);
+	for (slice = menu->list; slice; slice = slice->next) {
+		slice->pixmap = XCreatePixmap(pm->dpy, menu->win, pm->pie.diameter, pm->pie.diameter, pm->depth);
+		tally(pm, menu->level, MemSelection, pm->pie.diameter, pm->pie.diameter, pm->depth);
+		slice->picture = XRenderCreatePicture(pm->dpy, slice->pixmap, pm->xformat, CPPolyEdge | CPRepeat, &pm->dc.pictattr);
+		slice->draw = XftDrawCreate(pm->dpy, slice->pixmap, pm->visual, pm->colormap);
+		slice->drawn = 0;
+	}
+}
+
+/* query monitor information and, if querypointer is set, cursor position */
+static void
+getmonitor(struct PMenu *pm, int querypointer)
+{
+	const xcb_query_extension_reply_t *ext;
+	xcb_xinerama_query_screens_cookie_t scookie;
+	xcb_xinerama_query_screens_reply_t *sreply = NULL;
+	xcb_xinerama_screen_info_t *info;
+	xcb_query_pointer_cookie_t pcookie;
+	xcb_query_pointer_reply_t *preply;
+	int nmons;
+	int i;
+
+	/* send both queries before waiting for their replies */
+	if (querypointer) {
+		pcookie = xcb_query_pointer(pm->xconn, pm->rootwin);
+		pm->xcbbytes += XCBBYTES(xcb_query_pointer_request_t, 0);
+	}
+	ext = xcb_get_extension_data(pm->xconn, &xcb_xinerama_id);
+	if (ext != NULL && ext->present) {
+		scookie = xcb_xinerama_query_screens(pm->xconn);
+		pm->xcbbytes += XCBBYTES(xcb_xinerama_query_screens_request_t, 0);
+	}
+
+	pm->roundtrips++;
+	pm->mon.buttons = 0;
+	if (querypointer &&
+	    (preply = xcb_query_pointer_reply(pm->xconn, pcookie, NULL)) != NULL) {
+		pm->mon.cursx = preply->root_x;
+		pm->mon.cursy = preply->root_y;
+		pm->mon.buttons = preply->mask & BUTTONMASK;
+		free(preply);
+	}
+
+	pm->mon.x = pm->mon.y = 0;
+	pm->mon.w = DisplayWidth(pm->dpy, pm->screen);
+	pm->mon.h = DisplayHeight(pm->dpy, pm->screen);
+
+	if (ext != NULL && ext->present)
+		sreply = xcb_xinerama_query_screens_reply(pm->xconn, scookie, NULL);
+	if (sreply != NULL) {
+		int selmon = 0;
+
+		info = xcb_xinerama_query_screens_screen_info(sreply);
+		nmons = xcb_xinerama_query_screens_screen_info_length(sreply);
+		for (i = 0; i < nmons; i++) {
+			if (BETWEEN(pm->mon.cursx, info[i].x_org, info[i].x_org + info[i].width) &&
+			    BETWEEN(pm->mon.cursy, info[i].y_org, info[i].y_org + info[i].height)) {
+				selmon = i;
+				break;
+			}
+		}
+
+		if (nmons > 0) {
+			pm->mon.x = info[selmon].x_org;
+			pm->mon.y = info[selmon].y_org;
+			pm->mon.w = info[selmon].width;
+			pm->mon.h = info[selmon].height;
+		}
+
+		free(sreply);
+	}
+}
+
+/* setup the position of a menu */
+static void
+placemenu(struct PMenu *pm, struct Menu *menu)
+{
+	struct Slice *slice;
+	XWindowChanges changes;
+	Window w1;  /* dummy variable */
+	int x, y;   /* position of the center of the menu */
+	Bool ret;
+
+	/*if (menu->parent == NULL) {*/
+		x = pm->mon.cursx;
+		y = pm->mon.cursy;
+	/*} else {*/
+		/*ret = XTranslateCoordinates(pm->dpy, menu->parent->win, pm->rootwin,*/
+									/*menu->caller->x, menu->caller->y,*/
+									/*&x, &y, &w1);*/
+		/*if (ret == False)*/
+			/*errx(EXIT_FAILURE, "menus are on different screens");*/
+	/*}*/
+	menu->x = pm->mon.x; /* origin of monitor */
+	menu->y = pm->mon.y; /* origin of monitor */
+	if (x - pm->mon.x >= pm->pie.radius) {
+		if (pm->mon.x + pm->mon.w - x >= pm->pie.radius) {
+			menu->x = x - pm->pie.radius - pm->pie.border;
+        }
+		else if (pm->mon.x + pm->mon.w >= pm->pie.fulldiameter) {
+			menu->x = pm->mon.x + pm->mon.w - pm->pie.fulldiameter - 1;
+        }
+	}
+	if (y - pm->mon.y >= pm->pie.radius) {
+		if (pm->mon.y + pm->mon.h - y >= pm->pie.radius) {
+			menu->y = y - pm->pie.radius - pm->pie.border + 1;
+        }
+		else if (pm->mon.y + pm->mon.h >= pm->pie.fulldiameter) {
+			menu->y = pm->mon.y + pm->mon.h - pm->pie.fulldiameter;
+        }
+	}
+	changes.x = menu->x;
+	changes.y = menu->y;
+	if (menu->win != None)  /* otherwise, created there when set up */
+		XConfigureWindow(pm->dpy, menu->win, CWX | CWY, &changes);
+    if(menu->parent == NULL) {
+        XWarpPointer(pm->dpy, None, menu->win, 0, 0, 0, 0, pm->pie.radius, pm->pie.radius);
+    }
+	for (slice = menu->list; slice != NULL; slice = slice->next) {
+		if (slice->submenu != NULL) {
+			placemenu(pm, slice->submenu);
+		}
+	}
+}
+
+/* get menu of given window */
+static struct Menu *
+getmenu(struct Menu *currmenu, Window win)
+{
+	struct Menu *menu;
+
+	for (menu = currmenu; menu != NULL; menu = menu->parent)
+		if (menu->win == win)
+			return menu;
+
+	return NULL;
+}
+
+/* get slice of given menu and position */
+static struct Slice *
+getslice(struct PMenu *pm, struct Menu *menu, int x, int y)
+{
+	struct Slice *slice;
+	double angle;
+	int r;
+
+	if (menu == NULL)
+		return NULL;
+	PROBE3(getslice, menu->level, x, y);
+
+	x -= pm->pie.radius;
+	y -= pm->pie.radius;
+	y = -y;
+
+	/* if the cursor is in the middle disk, it is in no slice */
+	r = sqrt(x * x + y * y);
+	if (r <= pm->pie.centerdiskradius)
+		return NULL;
+
+	angle = atan2(y, x);
+	if (angle < 0.0) {
+		if (angle > -menu->half)
+			return menu->list;
+		angle = (2 * M_PI) + angle;
+	}
+	for (slice = menu->list; slice; slice = slice->next)
+		if (angle >= slice->anglea && angle < slice->angleb)
+			return slice;
+
+	return NULL;
+}
+
+/* umap previous menus and map current menu and its parents */
+static struct Menu *
+mapmenu(struct PMenu *pm, struct Menu *currmenu, struct Menu *prevmenu)
+{
+	struct Menu *menu, *menu_;
+	struct Menu *lcamenu;   /* lowest common ancestor menu */
+	unsigned minlevel;      /* level of the closest to root menu */
+	unsigned maxlevel;      /* level of the closest to root menu */
+
+	/* do not remap current menu if it wasn't updated*/
+	if (prevmenu == currmenu)
+		goto done;
+
+	for (menu = currmenu; menu != NULL; menu = menu->parent)
+		setupmenu(pm, menu);
+
+	/* if this is the first time mapping, skip calculations */
+	if (prevmenu == NULL) {
+		XMapRaised(pm->dpy, currmenu->win);
+		goto done;
+	}
+
+	/* find lowest common ancestor menu */
+	minlevel = MIN(currmenu->level, prevmenu->level);
+	maxlevel = MAX(currmenu->level, prevmenu->level);
+	if (currmenu->level == maxlevel) {
+		menu = currmenu;
+		menu_ = prevmenu;
+	} else {
+		menu = prevmenu;
+		menu_ = currmenu;
+	}
+	while (menu->level > minlevel)
+		menu = menu->parent;
+	while (menu != menu_) {
+		menu = menu->parent;
+		menu_ = menu_->parent;
+	}
+	lcamenu = menu;
+
+	/* unmap menus from currmenu (inclusive) until lcamenu (exclusive) */
+	for (menu = prevmenu; menu != lcamenu; menu = menu->parent) {
+		menu->selected = NULL;
+		XUnmapWindow(pm->dpy, menu->win);
+	}
+
+	/* map menus from currmenu (inclusive) until lcamenu (exclusive) */
+	for (menu = currmenu; menu != lcamenu; menu = menu->parent)
+		XMapRaised(pm->dpy, menu->win);
+
+done:
+	return currmenu;
+}
+
+/* umap urrent menu and its parents */
+static void
+unmapmenu(struct PMenu *pm, struct Menu *currmenu)
+{
+	struct Menu *menu;
+
+	/* unmap menus from currmenu (inclusive) until lcamenu (exclusive) */
+	for (menu = currmenu; menu; menu = menu->parent) {
+		menu->selected = NULL;
+		XUnmapWindow(pm->dpy, menu->win);
+	}
+}
+
+/* draw the wedge of the slice n of menus of nslices slices into a mask */
+static void
+drawwedge(struct PMenu *pm, Picture mask, unsigned nslices, unsigned n)
+{
+	XPointDouble *p;
+	int i, outer, inner, npoints;
+	double h, a, b;
+
+	/* determine number of segments to draw */
+	/*h = hypot(pm->pie.radius, pm->pie.radius)/2;*/
+	/*outer = ((2 * M_PI) / (menu->nslices * acos(h/(h+1.0)))) + 0.5;*/
+	/*outer = (outer < 3) ? 3 : outer;*/
+	/*h = hypot(pm->pie.centerdiskradius, pm->pie.centerdiskradius)/2;*/
+	/*inner = ((2 * M_PI) / (menu->nslices * acos(h/(h+1.0)))) + 0.5;*/
+	/*inner = (inner < 3) ? 3 : inner;*/
+    outer = inner = SLICESEGMENTS;
+	npoints = inner + outer + 2;
+	p = pm->pie.points;
+
+	b = ((2 * M_PI) / nslices) * n;
+
+	/* outer points */
+	a = ((2 * M_PI) / (nslices * outer));
+	for (i = 0; i <= outer; i++) {
+		p[i].x = pm->pie.radius + (pm->pie.radius + 1) * cos((i - (outer / 2.0)) * a - b);
+		p[i].y = pm->pie.radius + (pm->pie.radius + 1) * sin((i - (outer / 2.0)) * a - b);
+	}
+
+	/* inner points */
+	a = ((2 * M_PI) / (nslices * inner));
+	for (i = 0; i <= inner; i++) {
+		p[i + outer + 1].x = pm->pie.radius + pm->pie.centerdiskradius * cos(((inner - i) - (inner / 2.0)) * a - b);
+		p[i + outer + 1].y = pm->pie.radius + pm->pie.centerdiskradius * sin(((inner - i) - (inner / 2.0)) * a - b);
+	}
+	
+	XRenderCompositeDoublePoly(pm->dpy, PictOpOver, pm->pie.fg, mask,
+	                           pm->alphaformat, 0, 0, 0, 0, p, npoints, 0);
+}
+
+/* set a triangle from three points */
+static void
+settriangle(XTriangle *t, XPointDouble *p)
+{
+	t->p1.x = XDoubleToFixed(p[0].x);
+	t->p1.y = XDoubleToFixed(p[0].y);
+	t->p2.x = XDoubleToFixed(p[1].x);
+	t->p2.y = XDoubleToFixed(p[1].y);
+	t->p3.x = XDoubleToFixed(p[2].x);
+	t->p3.y = XDoubleToFixed(p[2].y);
+}
+
+/*
+ * Get the layers of menus of nslices slices, making them the first time:
+ * the mask of their separators and the outlines of their submenu
+ * triangles.  The rest of the pie geometry is the same for all menus, so
+ * nslices is enough of a key.  Return NULL on error.
+ */
+static struct Geometry *
+getgeometry(struct PMenu *pm, unsigned nslices)
+{
+	struct Geometry *g;
+	XTriangle *separators;  /* two triangles per separator */
+	XPointDouble p[4];
+	double a;
+	unsigned i;
+
+	for (g = pm->geometries; g != NULL; g = g->next)
+		if (g->nslices == nslices)
+			return g;
+	if ((g = emalloc(sizeof *g)) == NULL)
+		return NULL;
+	g->nslices = nslices;
+	g->wedges = emalloc(nslices * sizeof *g->wedges);
+	g->triangles = emalloc(nslices * sizeof *g->triangles);
+	g->scratch = emalloc(nslices * sizeof *g->scratch);
+	separators = emalloc(2 * nslices * sizeof *separators);
+	if (g->wedges == NULL || g->triangles == NULL || g->scratch == NULL || separators == NULL) {
+		free(g->wedges);
+		free(g->triangles);
+		free(g->scratch);
+		free(separators);
+		free(g);
+		return NULL;
+	}
+	for (i = 0; i < nslices; i++) {
+		g->wedges[i] = None;
+
+		/* separator before slice i, as a quad split in two triangles */
+		a = -((M_PI + 2 * M_PI * i) / nslices);
+		p[0].x = pm->pie.radius + pm->pie.separatorbeg * cos(a - pm->pie.innerangle);
+		p[0].y = pm->pie.radius + pm->pie.separatorbeg * sin(a - pm->pie.innerangle);
+		p[1].x = pm->pie.radius + pm->pie.separatorbeg * cos(a + pm->pie.innerangle);
+		p[1].y = pm->pie.radius + pm->pie.separatorbeg * sin(a + pm->pie.innerangle);
+		p[2].x = pm->pie.radius + pm->pie.separatorend * cos(a + pm->pie.outerangle);
+		p[2].y = pm->pie.radius + pm->pie.separatorend * sin(a + pm->pie.outerangle);
+		p[3].x = pm->pie.radius + pm->pie.separatorend * cos(a - pm->pie.outerangle);
+		p[3].y = pm->pie.radius + pm->pie.separatorend * sin(a - pm->pie.outerangle);
+		settriangle(&separators[2 * i], p);
+		p[1] = p[0];
+		settriangle(&separators[2 * i + 1], p + 1);
+
+		/* triangle pointing to the submenu of slice i */
+		a = - (((2 * M_PI) / nslices) * i);
+		p[0].x = pm->pie.radius + pm->pie.triangleinner * cos(a - pm->pie.triangleangle);
+		p[0].y = pm->pie.radius + pm->pie.triangleinner * sin(a - pm->pie.triangleangle);
+		p[1].x = pm->pie.radius + pm->pie.triangleouter * cos(a);
+		p[1].y = pm->pie.radius + pm->pie.triangleouter * sin(a);
+		p[2].x = pm->pie.radius + pm->pie.triangleinner * cos(a + pm->pie.triangleangle);
+		p[2].y = pm->pie.radius + pm->pie.triangleinner * sin(a + pm->pie.triangleangle);
+		settriangle(&g->triangles[i], p);
+	}
+	g->separators = createmask(pm);
+	XRenderCompositeTriangles(pm->dpy, PictOpOver, pm->pie.fg, g->separators,
+	                          pm->alphaformat, 0, 0, separators, 2 * nslices);
+	free(separators);
+	g->next = pm->geometries;
+	pm->geometries = g;
+	return g;
+}
+
+/* get the mask of the wedge of slice n of menus of a geometry, making it the first time */
+static Picture
+getwedge(struct PMenu *pm, struct Geometry *g, unsigned n)
+{
+	if (g->wedges[n] == None) {
+		g->wedges[n] = createmask(pm);
+		drawwedge(pm, g->wedges[n], g->nslices, n);
+	}
+	return g->wedges[n];
+}
+
+/*
+ * Draw the submenu triangles of a menu in one request, plus one for the
+ * triangle of the selected slice, which has another color.
+ */
+static void
+drawtriangles(struct PMenu *pm, Picture picture, struct Geometry *g,
+              struct Menu *menu, struct Slice *selected)
+{
+	struct Slice *slice;
+	int n = 0;
+
+	for (slice = menu->list; slice != NULL; slice = slice->next)
+		if (slice->submenu != NULL && slice != selected)
+			g->scratch[n++] = g->triangles[slice->slicen];
+	if (n > 0)
+		XRenderCompositeTriangles(pm->dpy, PictOpOver, pm->pie.fg, picture,
+		                          pm->alphaformat, 0, 0, g->scratch, n);
+	if (selected != NULL && selected->submenu != NULL)
+		XRenderCompositeTriangles(pm->dpy, PictOpOver, pm->pie.selfg, picture,
+		                          pm->alphaformat, 0, 0, &g->triangles[selected->slicen], 1);
+}
+
+/* draw regular slice */
+static void
+drawmenu(struct PMenu *pm, struct Menu *menu, struct Slice *selected)
+{
+	struct Geometry *g;
+	struct Slice *slice;
+	XftColor *color;
+	XftDraw *draw;
+	Drawable pixmap;
+	Picture picture;
+
+	PROBE2(drawmenu__begin, menu->level, selected ? (int)selected->slicen : -1);
+	if ((g = getgeometry(pm, menu->nslices)) == NULL) {
+		PROBE2(drawmenu__end, menu->level, selected ? (int)selected->slicen : -1);
+		return;
+	}
+	pm->ndraws++;
+	if (selected) {
+		pixmap = selected->pixmap;
+		picture = selected->picture;
+		draw = selected->draw;
+		selected->drawn = 1;
+	} else {
+		pixmap = menu->pixmap;
+		picture = menu->picture;
+		draw = menu->draw;
+		menu->drawn = 1;
+	}
+	if (menu == pm->rootmenu && pm->pixels.map != NULL) {
+		putpixels(pm, selected ? selected->slicen + 1 : 0, pixmap);
+		PROBE2(drawmenu__end, menu->level, selected ? (int)selected->slicen : -1);
+		return;
+	}
+
+	/*
+	 * Draw the background and the layers shared with the menus of as
+	 * many slices: the wedge of the selected slice, the center disk
+	 * and inner border, and the separators.
+	 */
+	XSetForeground(pm->dpy, pm->dc.gc, pm->dc.normal[ColorBG].pixel);
+	XFillRectangle(pm->dpy, pixmap, pm->dc.gc, 0, 0, pm->pie.diameter, pm->pie.diameter);
+	if (selected)
+		XRenderComposite(pm->dpy, PictOpOver, pm->pie.selbg, getwedge(pm, g, selected->slicen),
+		                 picture, 0, 0, 0, 0, 0, 0, pm->pie.diameter, pm->pie.diameter);
+	XRenderComposite(pm->dpy, PictOpOver, pm->pie.centerdisk, pm->pie.centerdiskmask,
+	                 picture, 0, 0, 0, 0, 0, 0, pm->pie.diameter, pm->pie.diameter);
+	XRenderComposite(pm->dpy, PictOpOver, pm->pie.separator, g->separators,
+	                 picture, 0, 0, 0, 0, 0, 0, pm->pie.diameter, pm->pie.diameter);
+
+	/* draw slice foreground */
+	for (slice = menu->list; slice; slice = slice->next) {
+		color = (slice == selected) ? pm->dc.selected : pm->dc.normal;
+
+		if (slice->iconw > 0) { /* if there is an icon, draw it */
+			XRenderComposite(pm->dpy, PictOpOver, menu->atlas, None, picture,
+			                 slice->atlasx, 0, 0, 0, slice->iconx, slice->icony,
+			                 slice->iconw, slice->iconh);
+		} else if (slice->label) {  /* otherwise, draw the label */
+			drawtext(pm, draw, &color[ColorFG], slice->labelx,
+			         slice->labely, slice->ucs, slice->ucslen);
+		}
+	}
+	if (pm->config.triangles)
+		drawtriangles(pm, picture, g, menu, selected);
+
+	PROBE2(drawmenu__end, menu->level, selected ? (int)selected->slicen : -1);
+}
+
+/* show pixmap on the window of menu */
+static void
+presentmenu(struct PMenu *pm, struct Menu *menu, Drawable pixmap)
+{
+	if (pm->presentopcode == 0) {
+		XCopyArea(pm->dpy, pixmap, menu->win, pm->dc.gc, 0, 0,
+		          pm->pie.diameter, pm->pie.diameter, 0, 0);
+		return;
+	}
+
+	/*
+	 * Target the retrace after the last frame shown; with a divisor of
+	 * one, a target already past is the next retrace.  If a previous
+	 * frame of this window is still pending for that retrace, the server
+	 * skips it and shows this one instead of queueing both.
+	 */
+	if (++pm->presentserial == 0)
+		pm->presentserial++;
+	menu->serial = pm->presentserial;
+	XPresentPixmap(pm->dpy, menu->win, pixmap, menu->serial, None, None, 0, 0,
+	               None, None, None, PresentOptionNone, menu->msc + 1, 1, 0,
+	               NULL, 0);
+}
+
+/* get the menu of given window anywhere in the menu tree */
+static struct Menu *
+findmenu(struct Menu *menu, Window win)
+{
+	struct Menu *found;
+	struct Slice *slice;
+
+	if (menu->win == win)
+		return menu;
+	for (slice = menu->list; slice != NULL; slice = slice->next)
+		if (slice->submenu != NULL &&
+		    (found = findmenu(slice->submenu, win)) != NULL)
+			return found;
+	return NULL;
+}
+
+/* record the completion of a frame presented with the Present extension */
+static void
+presentcomplete(struct PMenu *pm, XPresentCompleteNotifyEvent *ev)
+{
+	struct Menu *menu;
+
+	if (ev->kind != PresentCompleteKindPixmap)
+		return;
+	if (pm->rootmenu == NULL || (menu = findmenu(pm->rootmenu, ev->window)) == NULL)
+		return;
+	if (menu->serial == ev->serial_number)
+		menu->serial = 0;
+	if (ev->mode == PresentCompleteModeSkip)
+		return;
+	menu->msc = ev->msc;
+	if (pm->presented != NULL)
+		(*pm->presented)(pm->presentedarg, ev->serial_number, ev->ust);
+}
+
+/* draw slices of the current menu and of its ancestors */
+static void
+copymenu(struct PMenu *pm, struct Menu *currmenu)
+{
+	struct Menu *menu;
+	Drawable pixmap;
+
+	PROBE1(copymenu, currmenu->level);
+	for (menu = currmenu; menu != NULL; menu = menu->parent) {
+		if (menu->selected) {
+			pixmap = menu->selected->pixmap;
+			if (!menu->selected->drawn)
+				drawmenu(pm, menu, menu->selected);
+		} else {
+			pixmap = menu->pixmap;
+			if (!menu->drawn)
+				drawmenu(pm, menu, NULL);
+		}
+		presentmenu(pm, menu, pixmap);
+	}
+	pm->nframes++;
+}
+
+/* cycle through the slices; non-zero direction is next, zero is prev */
+static struct Slice *
+slicecycle(struct Menu *currmenu, int clockwise)
+{
+	struct Slice *slice;
+	struct Slice *lastslice;
+
+	slice = NULL;
+	if (clockwise) {
+		for (lastslice = currmenu->list;
+		     lastslice != NULL && lastslice->next != NULL;
+		     lastslice = lastslice->next)
+			;
+		if (currmenu->selected == NULL)
+			slice = currmenu->list;
+		else if (currmenu->selected->prev != NULL)
+			slice = currmenu->selected->prev;
+		if (slice == NULL)
+			slice = lastslice;
+	} else {
+		if (currmenu->selected == NULL)
+			slice = currmenu->list;
+		else if (currmenu->selected->next != NULL)
+			slice = currmenu->selected->next;
+		if (slice == NULL)
+			slice = currmenu->list;
+	}
+	return slice;
+}
+
+/* get local monotonic time in milliseconds */
+static uint64_t
+getmillis(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* start following the stroke of a held button from the center of the root menu */
+static void
+startgesture(struct PMenu *pm)
+{
+	pm->gesture.menu = pm->rootmenu;
+	pm->gesture.x = pm->rootmenu->x + pm->pie.border + pm->pie.radius;
+	pm->gesture.y = pm->rootmenu->y + pm->pie.border + pm->pie.radius;
+	pm->gesture.lastx = pm->gesture.x;
+	pm->gesture.lasty = pm->gesture.y;
+	pm->gesture.time = getmillis();
+}
+
+/* map a menu above its ancestors */
+static void
+mapancestors(struct PMenu *pm, struct Menu *menu)
+{
+	if (menu == NULL)
+		return;
+	mapancestors(pm, menu->parent);
+	setupmenu(pm, menu);
+	XMapRaised(pm->dpy, menu->win);
+}
+
+/* end the gesture and show the menu the stroke is in, centered at x, y */
+static int
+showgesture(struct PMenu *pm, int x, int y)
+{
+	struct Menu *menu;
+
+	menu = pm->gesture.menu;
+	pm->gesture.menu = NULL;
+
+	/* the ancestors stay where they were placed, like the stroke left them */
+	pm->mon.cursx = x;
+	pm->mon.cursy = y;
+	placemenu(pm, menu);
+	mapancestors(pm, menu);
+	pm->currmenu = pm->prevmenu = menu;
+	menu->selected = NULL;
+	copymenu(pm, menu);
+	return (menu == pm->rootmenu) ? PMENU_SELECT : PMENU_SUBMENU;
+}
+
+/*
+ * Follow the stroke of a gesture.  The stroke is segmented at its turns;
+ * the direction of each segment picks a slice of the menu the segment is
+ * in, as if the menu were centered where the segment began, and the
+ * stroke goes on in the submenu of that slice.  Releasing the button
+ * selects the slice the last segment points to.  No menu is drawn.
+ */
+static int
+gesture(struct PMenu *pm, XEvent *ev, const char **output)
+{
+	struct Gesture *g;
+	struct Slice *slice;
+	double segment, recent;
+	int x, y;
+
+	g = &pm->gesture;
+	if (ev->type == KeyPress) {
+		if (XkbKeycodeToKeysym(pm->dpy, ev->xkey.keycode, 0, 0) == XK_Escape)
+			return PMENU_CLOSE;
+		return PMENU_NONE;
+	}
+	if (ev->type == ButtonRelease) {
+		x = ev->xbutton.x_root;
+		y = ev->xbutton.y_root;
+		slice = getslice(pm, g->menu, pm->pie.radius + x - g->x, pm->pie.radius + y - g->y);
+		if (slice != NULL && slice->submenu == NULL) {
+			pm->outmenu = g->menu;
+			pm->outslice = slice;
+			if (pm->config.sticky)
+				showgesture(pm, x, y);
+			g->menu = NULL;
+			*output = slice->output;
+			return PMENU_OUTPUT;
+		}
+		if (slice != NULL)
+			g->menu = slice->submenu;
+		return showgesture(pm, x, y);
+	}
+
+	x = ev->xmotion.x_root;
+	y = ev->xmotion.y_root;
+	g->time = getmillis();
+	if (abs(x - g->lastx) + abs(y - g->lasty) < GESTURESTEP)
+		return PMENU_NONE;
+
+	/* a turn after a segment longer than the center disk ends the segment */
+	if (hypot(g->lastx - g->x, g->lasty - g->y) > pm->pie.centerdiskradius) {
+		segment = atan2(g->y - g->lasty, g->lastx - g->x);
+		recent = atan2(g->lasty - y, x - g->lastx);
+		if (fabs(remainder(recent - segment, 2 * M_PI)) > GESTURETURN) {
+			slice = getslice(pm, g->menu, pm->pie.radius + g->lastx - g->x,
+			                 pm->pie.radius + g->lasty - g->y);
+			if (slice != NULL && slice->submenu != NULL) {
+				g->menu = slice->submenu;
+				g->x = g->lastx;
+				g->y = g->lasty;
+				setuplayout(pm, g->menu);
+			}
+		}
+	}
+	g->lastx = x;
+	g->lasty = y;
+	return PMENU_NONE;
+}
+
+/* recursivelly free the slices and menus of a menu tree */
+static void
+freemenu(struct Menu *menu)
+{
+	struct Slice *slice;
+	struct Slice *tmp;
+
+	slice = menu->list;
+	while (slice != NULL) {
+		if (slice->submenu != NULL)
+			freemenu(slice->submenu);
+		tmp = slice;
+		slice = slice->next;
+		freeslice(tmp);
+	}
+	free(menu);
+}
+
+/* forget the pixels of the root menu, discarding a cache file not complete */
+static void
+closepixels(struct PMenu *pm)
+{
+	if (pm->pixels.map != NULL)
+		munmap(pm->pixels.map, pm->pixels.size);
+	if (pm->pixels.fp != NULL) {
+		fclose(pm->pixels.fp);
+		unlink(pm->pixels.tmp);
+	}
+	free(pm->pixels.tmp);
+	memset(&pm->pixels, 0, sizeof pm->pixels);
+}
+
+/* whether a state of the root menu is still to be kept for later runs */
+static int
+pixelspending(struct PMenu *pm)
+{
+	return pm->pixels.key != 0 && pm->pixels.map == NULL &&
+	       pm->rootmenu != NULL && pm->rootmenu->win != None;
+}
+
+/*
+ * Keep one more state of the root menu for later runs, the unselected
+ * one first, then each slice selected.  This is called while idle, one
+ * state at a time, so drawing the states not drawn yet and reading them
+ * back never delays an event or the exit.  The file is put in place once
+ * it holds every state, and discarded by closepixels() if it never does.
+ */
+static void
+savepixels(struct PMenu *pm)
+{
+	struct Menu *menu = pm->rootmenu;
+	struct PixelHeader header;
+	struct Slice *slice;
+	XImage *ximage;
+	Drawable pixmap;
+	char path[PATH_MAX];
+	char tmp[PATH_MAX];
+	unsigned n;
+	int fd, ok;
+
+	if (getpixelcachepath(pm->pixels.key, path, sizeof path) == -1)
+		goto error;
+	if (pm->pixels.fp == NULL) {
+		if (snprintf(tmp, sizeof tmp, "%s.XXXXXX", path) >= (int)sizeof tmp ||
+		    (fd = mkstemp(tmp)) == -1)
+			goto error;
+
+		/* the file stays open across ticks; hide it from spawned commands */
+		if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1 ||
+		    (pm->pixels.fp = fdopen(fd, "w")) == NULL ||
+		    (pm->pixels.tmp = estrdup(tmp)) == NULL) {
+			if (pm->pixels.fp != NULL)
+				fclose(pm->pixels.fp);
+			else
+				close(fd);
+			pm->pixels.fp = NULL;
+			unlink(tmp);
+			goto error;
+		}
+	}
+	if (pm->pixels.nsaved == 0) {
+		slice = NULL;
+		if (!menu->drawn)
+			drawmenu(pm, menu, NULL);
+		pixmap = menu->pixmap;
+	} else {
+		for (n = 1, slice = menu->list; n < pm->pixels.nsaved; n++)
+			slice = slice->next;
+		if (!slice->drawn)
+			drawmenu(pm, menu, slice);
+		pixmap = slice->pixmap;
+	}
+	ximage = XGetImage(pm->dpy, pixmap, 0, 0, pm->pie.diameter, pm->pie.diameter,
+	                   AllPlanes, ZPixmap);
+	if (ximage == NULL)
+		goto error;
+	ok = 1;
+	if (slice == NULL) {
+		memset(&header, 0, sizeof header);
+		memcpy(header.magic, PIXELCACHEMAGIC, sizeof header.magic);
+		header.key = pm->pixels.key;
+		header.nstates = menu->nslices + 1;
+		header.diameter = pm->pie.diameter;
+		header.depth = pm->depth;
+		header.bpp = ximage->bits_per_pixel;
+		header.bpl = ximage->bytes_per_line;
+		header.byteorder = ximage->byte_order;
+		pm->pixels.bpl = header.bpl;
+		ok = checkpixelformat(pm, &header) == 0 &&
+		     fwrite(&header, sizeof header, 1, pm->pixels.fp) == 1;
+	}
+	ok = ok && pm->pixels.bpl == (uint32_t)ximage->bytes_per_line &&
+	     fwrite(ximage->data, pm->pixels.bpl, pm->pie.diameter, pm->pixels.fp) ==
+	     (size_t)pm->pie.diameter;
+	XDestroyImage(ximage);
+	if (!ok)
+		goto error;
+	if (++pm->pixels.nsaved < menu->nslices + 1)
+		return;
+	ok = fclose(pm->pixels.fp) != EOF && rename(pm->pixels.tmp, path) == 0;
+	pm->pixels.fp = NULL;
+	if (!ok)
+		unlink(pm->pixels.tmp);
+	free(pm->pixels.tmp);
+	pm->pixels.tmp = NULL;
+	pm->pixels.key = 0;
+	return;
+
+error:
+	closepixels(pm);
+}
+
+/* recursivelly free pixmaps and pictures and destroy windows of menus set up */
+static void
+cleanmenu(struct PMenu *pm, struct Menu *menu)
+{
+	struct Slice *slice;
+
+	for (slice = menu->list; slice != NULL; slice = slice->next)
+		if (slice->submenu != NULL)
+			cleanmenu(pm, slice->submenu);
+	if (menu->win == None)
+		return;
+	for (slice = menu->list; slice != NULL; slice = slice->next) {
+		XftDrawDestroy(slice->draw);
+		XRenderFreePicture(pm->dpy, slice->picture);
+		XFreePixmap(pm->dpy, slice->pixmap);
+	}
+
+	if (menu->atlas != None)
+		XRenderFreePicture(pm->dpy, menu->atlas);
+	XftDrawDestroy(menu->draw);
+	XRenderFreePicture(pm->dpy, menu->picture);
+	XFreePixmap(pm->dpy, menu->pixmap);
+	XDestroyWindow(pm->dpy, menu->win);
+}
+
+/* free pictures and the pie masks */
+static void
+cleanpictures(struct PMenu *pm)
+{
+	struct Geometry *g;
+	unsigned i;
+
+	XRenderFreePicture(pm->dpy, pm->pie.bg);
+	XRenderFreePicture(pm->dpy, pm->pie.fg);
+	XRenderFreePicture(pm->dpy, pm->pie.selbg);
+	XRenderFreePicture(pm->dpy, pm->pie.selfg);
+	XRenderFreePicture(pm->dpy, pm->pie.separator);
+	XRenderFreePicture(pm->dpy, pm->pie.centerdisk);
+	XRenderFreePicture(pm->dpy, pm->pie.centerdiskmask);
+	XFreePixmap(pm->dpy, pm->pie.clip);
+	XFreePixmap(pm->dpy, pm->pie.bounding);
+	XFreeGC(pm->dpy, pm->pie.gc);
+	free(pm->pie.points);
+	while ((g = pm->geometries) != NULL) {
+		pm->geometries = g->next;
+		XRenderFreePicture(pm->dpy, g->separators);
+		for (i = 0; i < g->nslices; i++)
+			if (g->wedges[i] != None)
+				XRenderFreePicture(pm->dpy, g->wedges[i]);
+		free(g->wedges);
+		free(g->triangles);
+		free(g->scratch);
+		free(g);
+	}
+}
+
+/* cleanup drawing context */
+static void
+cleandc(struct PMenu *pm)
+{
+	char path[PATH_MAX];
+	size_t i;
+
+	cleancolors(pm);
+	if (pm->dc.fontcache.dirty && !pm->dc.fontcache.nomem &&
+	    getfontcachepath(&pm->dc.fontcache, path, sizeof path) == 0)
+		writefontcache(&pm->dc.fontcache, path);
+	freefontcache(&pm->dc.fontcache);
+	for (i = 0; i < pm->dc.nfonts; i++)
+		XftFontClose(pm->dpy, pm->dc.fonts[i]);
+	free(pm->dc.fonts);
+	FcPatternDestroy(pm->dc.pattern);
+	XFreeGC(pm->dpy, pm->dc.gc);
+}
+
+/* get default configuration */
+void
+pmenu_defaults(struct PMenuConfig *conf)
+{
+	*conf = config;
+}
+
+/* create an empty menu tree; return NULL on error */
+struct PMenuTree *
+pmenu_tree_create(void)
+{
+	struct PMenuTree *tree;
+
+	if ((tree = emalloc(sizeof *tree)) == NULL)
+		return NULL;
+	tree->root = NULL;
+	tree->prev = NULL;
+	tree->nlines = 0;
+	tree->hash = 0xCBF29CE484222325;
+	return tree;
+}
+
+/*
+ * Add a slice to the menu tree at given level; return -1 on improper
+ * indentation, with errno set to EINVAL, or if out of memory.
+ */
+int
+pmenu_tree_add(struct PMenuTree *tree, unsigned level, const char *label,
+               const char *output, const char *file)
+{
+	struct Slice *currslice = NULL;           /* slice currently being read */
+	struct Slice *slice;                      /* dummy slice for loops */
+	struct Menu *menu;                      /* dummy menu for loops */
+	unsigned i;
+	int invalid;
+
+	if (output == NULL)
+		output = label;
+	if (label == NULL && file == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* find the menu the slice goes into before creating the slice */
+	menu = tree->prev;
+	if (menu != NULL && level < menu->level) {
+		/* go up the menu tree until find the menu this slice continues */
+		for (i = level; menu != NULL && i != tree->prev->level; menu = menu->parent, i++)
+			;
+		if (menu == NULL) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	/* create the slice */
+	if ((currslice = allocslice(label, output, file)) == NULL)
+		return -1;
+
+	/* decode the label once; the text is only drawn from its code points */
+	if (label != NULL) {
+		if ((currslice->ucs = decodeutf8(label, &currslice->ucslen, &invalid)) == NULL) {
+			freeslice(currslice);
+			return -1;
+		}
+		if (invalid && tree->nlines > 0)
+			warnx("%lu: invalid UTF-8 in label", tree->nlines);
+		else if (invalid)
+			warnx("invalid UTF-8 in label: %s", label);
+	}
+
+	/* put the slice in the menu tree */
+	if (tree->prev == NULL) {               /* there is no menu yet */
+		if ((menu = allocmenu(NULL, currslice, level)) == NULL) {
+			freeslice(currslice);
+			return -1;
+		}
+		tree->root = menu;
+		tree->prev = menu;
+		currslice->prev = NULL;
+	} else if (level < tree->prev->level) { /* slice is continuation of a parent menu */
+		/* find last slice in the new menu */
+		for (slice = menu->list; slice->next != NULL; slice = slice->next)
+			;
+
+		tree->prev = menu;
+		slice->next = currslice;
+		currslice->prev = slice;
+	} else if (level == tree->prev->level) {        /* slice is a continuation of current menu */
+		/* find last slice in the previous menu */
+		for (slice = tree->prev->list; slice->next != NULL; slice = slice->next)
+			;
+
+		slice->next = currslice;
+		currslice->prev = slice;
+	} else {                                /* slice begins a new menu */
+		if ((menu = allocmenu(tree->prev, currslice, level)) == NULL) {
+			freeslice(currslice);
+			return -1;
+		}
+
+		/* find last slice in the previous menu */
+		for (slice = tree->prev->list; slice->next != NULL; slice = slice->next)
+			;
+
+		tree->prev = menu;
+		menu->caller = slice;
+		slice->submenu = menu;
+		currslice->prev = NULL;
+	}
+
+	tree->prev->nslices++;
+
+	return 0;
+}
+
+/* add the items read from fp to the menu tree; return -1 on invalid input or error */
+int
+pmenu_tree_parse(struct PMenuTree *tree, FILE *fp)
+{
+	char *s, buf[BUFSIZ];
+	char *file, *label, *output, *last;
+	unsigned level = 0;
+
+	while (fgets(buf, BUFSIZ, fp) != NULL) {
+		tree->nlines++;
+		for (s = buf; *s != '\0'; s++)
+			tree->hash = (tree->hash ^ (unsigned char)*s) * 0x100000001B3;
+
+		/* get the indentation level */
+		level = strspn(buf, "\t");
+
+		/* get the label */
+		s = level + buf;
+		label = strtok_r(s, "\t\n", &last);
+
+		if (label == NULL) {
+			warnx("%lu: empty item", tree->nlines);
+			return -1;
+		}
+
+		/* get the filename */
+		file = NULL;
+		if (strncmp(label, "IMG:", 4) == 0) {
+			file = label + 4;
+			label = NULL;
+		}
+
+		/* get the output */
+		output = strtok_r(NULL, "\n", &last);
+		if (output == NULL) {
+			output = label;
+		} else {
+			while (*output == '\t')
+				output++;
+		}
+
+		if (pmenu_tree_add(tree, level, label, output, file) == -1) {
+			if (errno == EINVAL)
+				warnx("%lu: improper indentation detected", tree->nlines);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* add the items in string s to the menu tree; return -1 on invalid input or error */
+int
+pmenu_tree_parsestring(struct PMenuTree *tree, const char *s)
+{
+	FILE *fp;
+	int ret;
+
+	if (*s == '\0')
+		return 0;
+	if ((fp = fmemopen((void *)s, strlen(s), "r")) == NULL) {
+		warn("fmemopen");
+		return -1;
+	}
+	ret = pmenu_tree_parse(tree, fp);
+	fclose(fp);
+	return ret;
+}
+
+/* free a menu tree not given to pmenu_settree() */
+void
+pmenu_tree_free(struct PMenuTree *tree)
+{
+	if (tree->root != NULL)
+		freemenu(tree->root);
+	free(tree);
+}
+
+/* create a pie menu on the given screen; return NULL on failure */
+struct PMenu *
+pmenu_create(Display *dpy, int screen, const struct PMenuConfig *conf)
+{
+	struct PMenu *pm;
+
+	if ((pm = emalloc(sizeof *pm)) == NULL)
+		return NULL;
+	memset(pm, 0, sizeof *pm);
+	if ((pm->pie.points = emalloc((2 * SLICESEGMENTS + 2) * sizeof *pm->pie.points)) == NULL) {
+		free(pm);
+		return NULL;
+	}
+	pm->dpy = dpy;
+	pm->screen = screen;
+	pm->visual = DefaultVisual(dpy, screen);
+	pm->rootwin = RootWindow(dpy, screen);
+	pm->colormap = DefaultColormap(dpy, screen);
+	pm->depth = DefaultDepth(dpy, screen);
+	pm->xformat = XRenderFindVisualFormat(dpy, pm->visual);
+	pm->alphaformat = XRenderFindStandardFormat(dpy, PictStandardA8);
+	pm->xconn = XGetXCBConnection(dpy);
+	xcb_prefetch_extension_data(pm->xconn, &xcb_xinerama_id);
+	pm->xcbbytes += XCBBYTES(xcb_query_extension_request_t, strlen("XINERAMA"));
+	pm->config = (conf != NULL) ? *conf : config;
+
+	/* imlib2 only loads and scales icons; the server composites them */
+	pm->imlib = imlib_context_new();
+	imlib_context_push(pm->imlib);
+	imlib_set_cache_size(2048 * 1024);
+	imlib_context_pop();
+
+	/* initializers */
+	initpresent(pm);
+	if (initdc(pm) == -1) {
+		imlib_context_free(pm->imlib);
+		free(pm->pie.points);
+		free(pm);
+		return NULL;
+	}
+	initpie(pm);
+
+	return pm;
+}
+
+/* set the menu tree of the pie menu, which takes ownership of it; return -1 if it is empty */
+int
+pmenu_settree(struct PMenu *pm, struct PMenuTree *tree)
+{
+	if (tree->root == NULL) {
+		pmenu_tree_free(tree);
+		return -1;
+	}
+	if (pm->rootmenu != NULL) {
+		pmenu_unmap(pm);
+		closepixels(pm);
+		cleanmenu(pm, pm->rootmenu);
+		freemenu(pm->rootmenu);
+	}
+	while (pm->nprewarm > 0)
+		free(pm->prewarm[--pm->nprewarm]);
+	pm->rootmenu = tree->root;
+	pm->currmenu = pm->prevmenu = NULL;
+	pm->outmenu = NULL;
+	pm->outslice = NULL;
+	free(tree);
+	setupmenu(pm, pm->rootmenu);
+	return 0;
+}
+
+/*
+ * Map the root menu on the monitor the pointer is on, centered at the
+ * pointer; if gestures are enabled and a button is held, follow its
+ * stroke instead.
+ */
+void
+pmenu_map(struct PMenu *pm)
+{
+	getmonitor(pm, 1);
+	pm->currmenu = pm->rootmenu;
+	placemenu(pm, pm->currmenu);
+	if (pm->config.gestures && pm->mon.buttons != 0) {
+		pm->prevmenu = NULL;
+		startgesture(pm);
+		return;
+	}
+	pm->prevmenu = mapmenu(pm, pm->currmenu, NULL);
+}
+
+/* map the root menu centered at the given root window position */
+void
+pmenu_mapat(struct PMenu *pm, int x, int y)
+{
+	pm->mon.cursx = x;
+	pm->mon.cursy = y;
+	getmonitor(pm, 0);
+	pm->currmenu = pm->rootmenu;
+	placemenu(pm, pm->currmenu);
+	pm->prevmenu = mapmenu(pm, pm->currmenu, NULL);
+}
+
+/* unmap the current menu and its parents */
+void
+pmenu_unmap(struct PMenu *pm)
+{
+	pm->gesture.menu = NULL;
+	if (pm->currmenu == NULL)
+		return;
+	unmapmenu(pm, pm->currmenu);
+	pm->currmenu = pm->prevmenu = NULL;
+}
+
+/*
+ * Handle an event of the display.  Return what was done with it; on
+ * PMENU_OUTPUT, set output to the output of the selected slice, which
+ * is valid until the menu tree is changed or the pie menu destroyed.
+ */
+int
+pmenu_handle(struct PMenu *pm, XEvent *ev, const char **output)
+{
+	struct Menu *menu = NULL;
+	struct Slice *slice = NULL;
+	KeySym ksym;
+	int ret = PMENU_NONE;
+
+	if (pm->currmenu == NULL)
+		return PMENU_NONE;
+	PROBE2(event, ev->type, pm->currmenu->level);
+	if (pm->gesture.menu != NULL &&
+	    (ev->type == MotionNotify || ev->type == ButtonRelease || ev->type == KeyPress))
+		return gesture(pm, ev, output);
+	switch (ev->type) {
+	case Expose:
+		if (ev->xexpose.count == 0)
+			copymenu(pm, pm->currmenu);
+		break;
+	case EnterNotify:
+		menu = getmenu(pm->currmenu, ev->xcrossing.window);
+		if (menu == NULL)
+			break;
+		pm->prevmenu = mapmenu(pm, pm->currmenu, pm->prevmenu);
+		copymenu(pm, pm->currmenu);
+		break;
+	case LeaveNotify:
+		menu = getmenu(pm->currmenu, ev->xcrossing.window);
+		if (menu == NULL)
+			break;
+		if ((menu != pm->rootmenu && menu == pm->currmenu)
+		    || (menu == pm->rootmenu && pm->currmenu == pm->rootmenu))
+			return PMENU_CLOSE;
+		break;
+	case MotionNotify:
+		menu = getmenu(pm->currmenu, ev->xbutton.window);
+		slice = getslice(pm, menu, ev->xbutton.x, ev->xbutton.y);
+		if (menu == NULL)
+			break;
+		if (slice != menu->selected)
+			ret = PMENU_SELECT;
+		menu->selected = slice;
+		copymenu(pm, pm->currmenu);
+		break;
+	case ButtonRelease:
+		menu = getmenu(pm->currmenu, ev->xbutton.window);
+		slice = getslice(pm, menu, ev->xbutton.x, ev->xbutton.y);
+		if (menu == NULL || slice == NULL)
+			break;
+selectslice:
+		if (slice->submenu == NULL) {
+			pm->outmenu = menu;
+			pm->outslice = slice;
+			*output = slice->output;
+			return PMENU_OUTPUT;
+		}
+		ret = PMENU_SUBMENU;
+		pm->currmenu = slice->submenu;
+		pm->prevmenu = mapmenu(pm, pm->currmenu, pm->prevmenu);
+		pm->currmenu->selected = NULL;
+		copymenu(pm, pm->currmenu);
+		if (pm->config.warp)
+			XWarpPointer(pm->dpy, None, pm->currmenu->win, 0, 0, 0, 0,
+			             pm->pie.radius, pm->pie.radius);
+		break;
+	case ButtonPress:
+		menu = getmenu(pm->currmenu, ev->xbutton.window);
+		slice = getslice(pm, menu, ev->xbutton.x, ev->xbutton.y);
+		if (menu == NULL || (slice == NULL && menu == pm->rootmenu))
+			return PMENU_CLOSE;
+		if (slice == NULL) {
+			ret = PMENU_SELECT;
+			pm->currmenu = pm->currmenu->parent;
+			pm->prevmenu = mapmenu(pm, pm->currmenu, pm->prevmenu);
+			pm->currmenu->selected = NULL;
+			copymenu(pm, pm->currmenu);
+		}
+		break;
+	case KeyPress:
+		ksym = XkbKeycodeToKeysym(pm->dpy, ev->xkey.keycode, 0, 0);
+
+		/* esc closes pmenu when current menu is the root menu */
+		if (ksym == XK_Escape && pm->currmenu->parent == NULL)
+			return PMENU_CLOSE;
+
+		/* Shift-Tab = ISO_Left_Tab */
+		if (ksym == XK_Tab && (ev->xkey.state & ShiftMask))
+			ksym = XK_ISO_Left_Tab;
+
+		/* cycle through menu */
+		slice = NULL;
+		if (ksym == XK_Tab) {
+			slice = slicecycle(pm->currmenu, 1);
+		} else if (ksym == XK_ISO_Left_Tab) {
+			slice = slicecycle(pm->currmenu, 0);
+		} else if ((ksym == XK_Return) &&
+		           pm->currmenu->selected != NULL) {
+			menu = pm->currmenu;
+			slice = pm->currmenu->selected;
+			goto selectslice;
+		} else if ((ksym == XK_Escape) &&
+		           pm->currmenu->parent != NULL) {
+			slice = pm->currmenu->parent->selected;
+			pm->currmenu = pm->currmenu->parent;
+			pm->prevmenu = mapmenu(pm, pm->currmenu, pm->prevmenu);
+		} else
+			break;
+		ret = PMENU_SELECT;
+		pm->currmenu->selected = slice;
+		copymenu(pm, pm->currmenu);
+		break;
+	case ConfigureNotify:
+		menu = getmenu(pm->currmenu, ev->xconfigure.window);
+		if (menu == NULL)
+			break;
+		menu->x = ev->xconfigure.x;
+		menu->y = ev->xconfigure.y;
+		break;
+	case GenericEvent:
+		if (pm->presentopcode == 0 ||
+		    ev->xcookie.extension != pm->presentopcode ||
+		    !XGetEventData(pm->dpy, &ev->xcookie))
+			break;
+		if (ev->xcookie.evtype == PresentCompleteNotify)
+			presentcomplete(pm, ev->xcookie.data);
+		XFreeEventData(pm->dpy, &ev->xcookie);
+		break;
+	}
+	return ret;
+}
+
+/* get a submenu of the current menu that can be set up while idle, or NULL */
+static struct Menu *
+idlemenu(struct PMenu *pm)
+{
+	struct Slice *slice;
+
+	if (pm->currmenu == NULL)
+		return NULL;
+	for (slice = pm->currmenu->list; slice != NULL; slice = slice->next)
+		if (slice->submenu != NULL && slice->submenu->win == None)
+			return slice->submenu;
+	return NULL;
+}
+
+/* set up and draw the menus along a slice path, with the slices of the path selected */
+static void
+prewarmpath(struct PMenu *pm, const char *path)
+{
+	struct Menu *menu;
+	struct Slice *slice;
+	unsigned long n;
+	char *end;
+
+	for (menu = pm->rootmenu; menu != NULL && *path == '/'; path = end) {
+		n = strtoul(path + 1, &end, 10);
+		if (end == path + 1)
+			return;
+		setupmenu(pm, menu);
+		for (slice = menu->list; slice != NULL && n > 0; slice = slice->next)
+			n--;
+		if (slice == NULL)
+			return;
+		if (!menu->drawn)
+			drawmenu(pm, menu, NULL);
+		if (!slice->drawn)
+			drawmenu(pm, menu, slice);
+		menu = slice->submenu;
+	}
+}
+
+/* write the path of the slice last output into buf; return -1 if there is none */
+int
+pmenu_getpath(struct PMenu *pm, char *buf, size_t size)
+{
+	struct Menu *menu;
+	struct Slice *slice, *s;
+	char tmp[BUFSIZ];
+	unsigned n;
+
+	if (pm->outslice == NULL || size == 0)
+		return -1;
+	buf[0] = '\0';
+	for (menu = pm->outmenu, slice = pm->outslice; menu != NULL;
+	     slice = menu->caller, menu = menu->parent) {
+		for (n = 0, s = menu->list; s != slice; s = s->next)
+			n++;
+		(void)snprintf(tmp, sizeof tmp, "/%u%s", n, buf);
+		(void)snprintf(buf, size, "%s", tmp);
+	}
+	return 0;
+}
+
+/* queue a slice path to be prepared while idle, most likely first; return -1 if full or on error */
+int
+pmenu_prewarm(struct PMenu *pm, const char *path)
+{
+	if (pm->nprewarm == PREWARMMAX ||
+	    (pm->prewarm[pm->nprewarm] = estrdup(path)) == NULL)
+		return -1;
+	pm->nprewarm++;
+	return 0;
+}
+
+/* get milliseconds until pmenu_tick() has to be called, -1 if never */
+int
+pmenu_timeout(struct PMenu *pm)
+{
+	uint64_t elapsed;
+
+	if (pm->gesture.menu != NULL) {
+		elapsed = getmillis() - pm->gesture.time;
+		if (elapsed >= pm->config.gesture_dwell)
+			return 0;
+		return pm->config.gesture_dwell - elapsed;
+	}
+	return (pm->nprewarm > 0 || idlemenu(pm) != NULL || pixelspending(pm)) ? 0 : -1;
+}
+
+/*
+ * Show the menus of a gesture whose stroke paused, or else prepare the
+ * next likely slice path, set up one of the submenus that can be opened
+ * next or keep a state of the root menu; return what was done.
+ */
+int
+pmenu_tick(struct PMenu *pm)
+{
+	struct Menu *menu;
+	size_t i;
+
+	if (pm->gesture.menu != NULL) {
+		if (pmenu_timeout(pm) != 0)
+			return PMENU_NONE;
+		return showgesture(pm, pm->gesture.lastx, pm->gesture.lasty);
+	}
+	if (pm->nprewarm > 0) {
+		prewarmpath(pm, pm->prewarm[0]);
+		free(pm->prewarm[0]);
+		for (i = 1; i < pm->nprewarm; i++)
+			pm->prewarm[i - 1] = pm->prewarm[i];
+		pm->nprewarm--;
+	} else if ((menu = idlemenu(pm)) != NULL)
+		setupmenu(pm, menu);
+	else if (pixelspending(pm))
+		savepixels(pm);
+	return PMENU_NONE;
+}
+
+/* destroy the pie menu and its menu tree; the display is left open */
+void
+pmenu_destroy(struct PMenu *pm)
+{
+	if (pm->rootmenu != NULL) {
+		pmenu_unmap(pm);
+		closepixels(pm);
+		cleanmenu(pm, pm->rootmenu);
+		freemenu(pm->rootmenu);
+	}
+	while (pm->nprewarm > 0)
+		free(pm->prewarm[--pm->nprewarm]);
+	cleanpictures(pm);
+	cleandc(pm);
+	imlib_context_free(pm->imlib);
+	closeiconindex(pm->icons);
+	free(pm);
+}
+
+/* get the menu of given window anywhere in the menu tree */
+struct Menu *
+pmenu_findmenu(struct Menu *menu, Window win)
+{
+	return findmenu(menu, win);
+}
+
+/* get slice of given menu and position */
+struct Slice *
+pmenu_getslice(struct PMenu *pm, struct Menu *menu, int x, int y)
+{
+	return getslice(pm, menu, x, y);
+}
+
+/* compute the angles of menu's slices and the positions of their labels */
+void
+pmenu_layout(struct PMenu *pm, struct Menu *menu)
+{
+	layoutmenu(pm, menu);
+}
+
+/* get the width of decoded text in the font */
+int
+pmenu_textwidth(struct PMenu *pm, const FcChar32 *ucs, size_t len)
+{
+	return drawtext(pm, NULL, NULL, 0, 0, ucs, len);
+}
+
+/* decode the UTF-8 string s into a new array of code points; return NULL on error */
+FcChar32 *
+pmenu_utf8decode(const char *s, size_t *len_ret, int *invalid_ret)
+{
+	return decodeutf8(s, len_ret, invalid_ret);
+}
@@ -0,0 +1,95 @@
+/*
+ * libpmenu: pie menus embeddable in other X programs.
+ *
+ * A menu tree is built with pmenu_tree_add(), parsed from the pmenu
+ * input format, or made by pmenu_tree_apps() from the desktop entries of
+ * the applications installed, and given to a pie menu created on an open display.
+ * The host program runs the event loop and feeds pmenu_handle() with
+ * the events of the display, which draws the menus and says what the
+ * user did.  The host is responsible for grabbing pointer and keyboard.
+ *
+ * With gestures enabled, pmenu_map() called while a button is held maps
+ * nothing: the stroke of the pointer descends into submenus and releasing
+ * the button selects, without drawing any menu.  The host must poll with
+ * the timeout given by pmenu_timeout() and call pmenu_tick() when it
+ * expires, so the menus are shown when the stroke pauses.  The same
+ * calls set up, while the host is idle, the submenus that can be opened
+ * next; otherwise a submenu is set up when it is first opened.  With
+ * pixel_cache, they also save the pixels of the root menu while idle.
+ *
+ * With sticky menus, pmenu_handle() can return PMENU_OUTPUT many times:
+ * the menus stay as they were, and a leaf selected by a stroke shows the
+ * menu the stroke ended in.  The host decides when the session ends.
+ *
+ * Slices are identified by paths of their indices from the root menu,
+ * like "/2/0/5".  pmenu_getpath() gives the path of the slice last
+ * output, and pmenu_prewarm() queues a path likely to be selected, whose
+ * menus are then set up and drawn ahead of use by pmenu_tick().
+ *
+ * The library never exits its host: functions that fail warn on stderr
+ * and return NULL or -1.
+ */
+
+#include <stdio.h>
+#include <X11/Xlib.h>
+
+struct PMenu;
+struct PMenuTree;
+
+/* configuration of a pie menu */
+struct PMenuConfig {
+	const char *font;
+	const char *icon_theme;         /* icon theme of icons named without a path */
+	const char *background_color;
+	const char *foreground_color;
+	const char *selbackground_color;
+	const char *selforeground_color;
+	const char *separator_color;
+	const char *border_color;
+	int border_pixels;
+	int separator_pixels;
+	int triangle_width;
+	int triangle_height;
+	int triangle_distance;
+	unsigned diameter_pixels;
+	double separatorbeg;
+	double separatorend;
+	double centerdiskradius;
+	int triangles;          /* whether to draw triangle for submenus */
+	int warp;               /* whether to warp the pointer into submenus */
+	int gestures;           /* whether a held button strokes through unmapped menus */
+	unsigned gesture_dwell; /* milliseconds the stroke pauses before menus are shown */
+	int sticky;             /* whether menus stay open after a leaf is selected */
+	int pixel_cache;        /* whether the pixels of the root menu are kept across runs */
+};
+
+/* what pmenu_handle() did with an event */
+enum {
+	PMENU_NONE,             /* nothing visible changed */
+	PMENU_SELECT,           /* the selected slice or the current menu changed */
+	PMENU_SUBMENU,          /* a submenu was opened */
+	PMENU_OUTPUT,           /* a leaf was selected; its output is returned */
+	PMENU_CLOSE,            /* the user closed the menu */
+};
+
+void pmenu_defaults(struct PMenuConfig *config);
+
+struct PMenuTree *pmenu_tree_create(void);
+int pmenu_tree_add(struct PMenuTree *tree, unsigned level, const char *label,
+                   const char *output, const char *file);
+int pmenu_tree_parse(struct PMenuTree *tree, FILE *fp);
+int pmenu_tree_parsestring(struct PMenuTree *tree, const char *s);
+int pmenu_tree_apps(struct PMenuTree *tree);
+void pmenu_tree_free(struct PMenuTree *tree);
+
+struct PMenu *pmenu_create(Display *dpy, int screen, const struct PMenuConfig *config);
+int pmenu_settree(struct PMenu *pm, struct PMenuTree *tree);
+void pmenu_map(struct PMenu *pm);
+void pmenu_mapat(struct PMenu *pm, int x, int y);
+void pmenu_unmap(struct PMenu *pm);
+int pmenu_handle(struct PMenu *pm, XEvent *ev, const char **output);
+int pmenu_timeout(struct PMenu *pm);
+int pmenu_tick(struct PMenu *pm);
+int pmenu_getpath(struct PMenu *pm, char *buf, size_t size);
+int pmenu_prewarm(struct PMenu *pm, const char *path);
+void pmenu_destroy(struct PMenu *pm);
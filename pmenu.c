@@ -1,51 +1,332 @@
-#include <ctype.h>
 #include <err.h>
-#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <X11/Xlib.h>
-#include <X11/Xutil.h>
+#include <X11/Xlib-xcb.h>
+#include <X11/Xlibint.h>
 #include <X11/Xresource.h>
 #include <X11/XKBlib.h>
 #include <X11/Xft/Xft.h>
-#include <X11/extensions/shape.h>
-#include <X11/extensions/Xinerama.h>
+#include <X11/extensions/Xpresent.h>
+#include <X11/extensions/XRes.h>
+#include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 #include <Imlib2.h>
+#include "libpmenu.h"
 #include "pmenu.h"
 
 /* X stuff */
 static Display *dpy;
-static Visual *visual;
+static xcb_connection_t *xconn;
 static Window rootwin;
-static Colormap colormap;
 static XrmDatabase xdb;
-static XRenderPictFormat *xformat;
 static char *xrm;
-static int screen;
-static int depth;
-static struct DC dc;
-static struct Monitor mon;
 
-/* The pie bitmap structure */
-static struct Pie pie;
+extern char **environ;
 
-/* flags */
-static int tflag = 0;           /* whether to draw triangle for submenus */
-static int wflag = 0;           /* whether to disable pointer warping */
+/* the pie menu and its configuration */
+static struct PMenu *pm;
+static struct PMenuConfig config;
 
-#include "config.h"
+/* flags */
+static int Tflag = 0;           /* whether to print startup timing */
+static int Cflag = 0;           /* whether to count X protocol traffic */
+static int Lflag = 0;           /* whether to record input latency */
+static int fflag = 0;           /* whether to replay events as fast as possible */
+static int Bflag = 0;           /* whether to benchmark the menu setup and exit */
+static int aflag = 0;           /* whether to build the menu from the desktop entries */
+static int xflag = 0;           /* whether to run the output rather than print it */
+static int Mflag = 0;           /* whether to report memory usage */
+static int sflag = 0;           /* whether selections keep the menu open */
+
+/* startup timing */
+static struct timespec starttime;
+
+/* pointer and keyboard grabs */
+static struct Grab grabbed;
+
+/* X protocol accounting */
+static struct Traffic traffic[PhaseLast];
+static struct Traffic lasttraffic;      /* totals at the last call to account() */
+static unsigned long roundtrips;        /* total replies waited for */
+static unsigned long lastprocessed;     /* last request known to be processed */
+static unsigned long xlibbytes;         /* bytes of the requests Xlib sent */
+static unsigned long xcbbytes;          /* bytes of the requests we sent with XCB */
+static int (*afterfunc)(Display *);     /* previous Xlib after function */
+
+/* input-to-present latency */
+static struct Histogram histograms[LatencyLast];
+static struct Pending pending[LATPENDING];
+static size_t npending;
+static int64_t clockoffset = INT64_MAX; /* local clock minus server clock */
+static volatile sig_atomic_t dumplatency = 0;
+
+/* event recording and replaying */
+static FILE *recordfp;                  /* file events are recorded into */
+static FILE *replayfp;                  /* file events are replayed from */
+static uint64_t lastevent;              /* local time of the previous event */
+static struct Work replaywork;          /* work done by the replayed events */
+static unsigned long steadyallocs;      /* replayed events allocating without drawing a new menu */
+
+/* heap allocations, counted while replaying by the check build (see test/allocs.c) */
+#ifdef CHECK
+extern int countallocs;
+extern unsigned long nallocs;
+#endif
+static unsigned long handleallocs;      /* made by the last call to handle() */
+
+/* usage statistics */
+static const char *usagefile;           /* file usage statistics are kept in */
+static uint64_t spechash;               /* hash of the menu specification */
+
+/* memory accounting */
+static size_t heappeak;                 /* most heap in use after an event */
+
+/* benchmarking */
+static uint64_t parsetime;              /* time spent parsing stdin */
+static volatile unsigned long benchsink;/* keeps benchmarked results alive */
 
 /* show usage */
 static void
 usage(void)
 {
-	(void)fprintf(stderr, "usage: pmenu [-w]\n");
+	(void)fprintf(stderr, "usage: pmenu [-aBCfgLMPsTtwx] [-R file] [-r file] [-u file]\n");
 	exit(1);
 }
 
+/* print time elapsed since startup, if -T was given */
+static void
+timing(const char *what)
+{
+	struct timespec ts;
+
+	if (!Tflag)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	(void)fprintf(stderr, "%s: %9.3fms %s\n", PROGNAME,
+	              (ts.tv_sec - starttime.tv_sec) * 1e3 +
+	              (ts.tv_nsec - starttime.tv_nsec) / 1e6, what);
+}
+
+/*
+ * Xlib calls this after each function that sends a request.  The last
+ * request known to be processed only moves forward outside of event
+ * reading when Xlib waited for a reply, so count a round trip then;
+ * resync() catches up with it after events are read.
+ */
+static int
+countafter(Display *d)
+{
+	unsigned long processed;
+
+	processed = LastKnownRequestProcessed(d);
+	if (processed != lastprocessed) {
+		lastprocessed = processed;
+		roundtrips++;
+	}
+	return afterfunc != NULL ? (*afterfunc)(d) : 0;
+}
+
+/* forget the requests processed as seen while reading events */
+static void
+resync(void)
+{
+	if (Cflag)
+		lastprocessed = LastKnownRequestProcessed(dpy);
+}
+
+/* Xlib calls this with each chunk of requests it writes to the connection */
+static void
+countflush(Display *d, XExtCodes *codes, const char *data, long len)
+{
+	(void)d;
+	(void)codes;
+	(void)data;
+	xlibbytes += len;
+}
+
+/* get the bytes of requests sent so far, by Xlib and directly with XCB */
+static unsigned long
+bytessent(void)
+{
+	return xlibbytes + xcbbytes + (pm != NULL ? pm->xcbbytes : 0);
+}
+
+/* start counting X protocol traffic, if -C was given */
+static void
+initaccount(void)
+{
+	if (!Cflag)
+		return;
+	afterfunc = XSetAfterFunction(dpy, countafter);
+	XESetBeforeFlush(dpy, XAddExtension(dpy)->extension, countflush);
+	lastprocessed = LastKnownRequestProcessed(dpy);
+	lasttraffic.requests = NextRequest(dpy);
+	lasttraffic.bytes = bytessent();
+}
+
+/* attribute X protocol traffic since the previous call to given phase */
+static void
+account(int phase)
+{
+	unsigned long requests, bytes;
+
+	if (!Cflag)
+		return;
+
+	/* flush now rather than in XNextEvent(), so bytes go to this phase */
+	XFlush(dpy);
+	lastprocessed = LastKnownRequestProcessed(dpy);
+	requests = NextRequest(dpy);
+	bytes = bytessent();
+	traffic[phase].count++;
+	traffic[phase].requests += requests - lasttraffic.requests;
+	traffic[phase].roundtrips += roundtrips + pm->roundtrips - lasttraffic.roundtrips;
+	traffic[phase].bytes += bytes - lasttraffic.bytes;
+	lasttraffic.requests = requests;
+	lasttraffic.roundtrips = roundtrips + pm->roundtrips;
+	lasttraffic.bytes = bytes;
+}
+
+/* print X protocol traffic per phase, if -C was given */
+static void
+printaccount(void)
+{
+	static const char *names[PhaseLast] = {
+		[PhaseStartup]    = "startup",
+		[PhaseFirstFrame] = "first frame",
+		[PhaseMotion]     = "motion event",
+		[PhaseSubmenu]    = "submenu open",
+		[PhaseOther]      = "other event",
+	};
+	struct Traffic *t;
+	int i;
+
+	if (!Cflag)
+		return;
+	(void)fprintf(stderr, "%s: %-12s %6s %10s %10s %12s\n", PROGNAME,
+	              "phase", "count", "requests", "roundtrips", "bytes");
+	for (i = 0; i < PhaseLast; i++) {
+		t = &traffic[i];
+		if (t->count == 0)
+			continue;
+		(void)fprintf(stderr, "%s: %-12s %6lu %10lu %10lu %12lu\n", PROGNAME,
+		              names[i], t->count, t->requests, t->roundtrips, t->bytes);
+		if (t->count > 1)
+			(void)fprintf(stderr, "%s: %-12s %6s %10.1f %10.1f %12.1f\n", PROGNAME,
+			              "  average", "", (double)t->requests / t->count,
+			              (double)t->roundtrips / t->count,
+			              (double)t->bytes / t->count);
+	}
+}
+
+/* return the heap in use, or 0 where malloc cannot tell */
+static size_t
+heapinuse(size_t *arena_ret, size_t *mmapped_ret)
+{
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+	struct mallinfo2 mi;
+
+	mi = mallinfo2();
+	*arena_ret = mi.arena;
+	*mmapped_ret = mi.hblkhd;
+	return mi.uordblks + mi.hblkhd;
+#else
+	*arena_ret = *mmapped_ret = 0;
+	return 0;
+#endif
+}
+
+/* note the heap in use after an event, if -M was given */
+static void
+sampleheap(void)
+{
+	size_t arena, mmapped, inuse;
+
+	if (!Mflag)
+		return;
+	inuse = heapinuse(&arena, &mmapped);
+	heappeak = MAX(heappeak, inuse);
+}
+
+/* print the X resources made per menu level and the heap, if -M was given */
+static void
+printmemory(void)
+{
+	static const char *names[MemLast] = {
+		[MemWindow]    = "window",
+		[MemMenu]      = "menu pixmap",
+		[MemSelection] = "selection",
+		[MemIcons]     = "icons",
+		[MemShared]    = "shared",
+	};
+	struct Tally *t, total;
+	struct rusage ru;
+	XResType *types;
+	unsigned long pixmapbytes;
+	size_t arena, mmapped, inuse;
+	int i, j, ntypes, evbase, errbase;
+	char *name;
+
+	if (!Mflag)
+		return;
+	(void)fprintf(stderr, "%s: %-12s %5s %6s %12s\n", PROGNAME,
+	              "resource", "level", "count", "bytes");
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < MemLast; i++) {
+		for (j = 0; j < TALLYLEVELS; j++) {
+			t = &pm->tally[j][i];
+			if (t->count == 0)
+				continue;
+			(void)fprintf(stderr, "%s: %-12s %4d%s %6lu %12lu\n", PROGNAME,
+			              names[i], j, (j == TALLYLEVELS - 1) ? "+" : " ",
+			              t->count, t->bytes);
+			total.count += t->count;
+			total.bytes += t->bytes;
+		}
+	}
+	(void)fprintf(stderr, "%s: %-12s %5s %6lu %12lu\n", PROGNAME,
+	              "total", "", total.count, total.bytes);
+
+	/* what the server holds for us, glyph sets included */
+	if (pm->rootmenu != NULL && XResQueryExtension(dpy, &evbase, &errbase)) {
+		if (XResQueryClientPixmapBytes(dpy, pm->rootmenu->win, &pixmapbytes))
+			(void)fprintf(stderr, "%s: server pixmap bytes %lu\n",
+			              PROGNAME, pixmapbytes);
+		if (XResQueryClientResources(dpy, pm->rootmenu->win, &ntypes, &types)) {
+			for (i = 0; i < ntypes; i++) {
+				if ((name = XGetAtomName(dpy, types[i].resource_type)) == NULL)
+					continue;
+				(void)fprintf(stderr, "%s: server %-16s %6u\n", PROGNAME,
+				              name, types[i].count);
+				XFree(name);
+			}
+			XFree(types);
+		}
+	}
+
+	inuse = heapinuse(&arena, &mmapped);
+	heappeak = MAX(heappeak, inuse);
+	(void)fprintf(stderr, "%s: heap arena %zu, mmapped %zu, in use %zu, peak %zu\n",
+	              PROGNAME, arena, mmapped, inuse, heappeak);
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+		(void)fprintf(stderr, "%s: max resident set %ld KiB\n", PROGNAME, ru.ru_maxrss);
+}
+
 /* read xrdb for configuration options */
 static void
 getresources(void)
@@ -55,6 +336,8 @@ getresources(void)
 
 	if (xrm == NULL || xdb == NULL)
 		return;
+	if (XrmGetResource(xdb, "pmenu.gestureDwell", "*", &type, &xval) == True)
+		config.gesture_dwell = strtoul(xval.addr, NULL, 10);
 	if (XrmGetResource(xdb, "pmenu.diameterWidth", "*", &type, &xval) == True)
 		config.diameter_pixels = strtoul(xval.addr, NULL, 10);
 	if (XrmGetResource(xdb, "pmenu.borderWidth", "*", &type, &xval) == True)
@@ -75,6 +358,8 @@ getresources(void)
 		config.border_color = xval.addr;
 	if (XrmGetResource(xdb, "pmenu.font", "*", &type, &xval) == True)
 		config.font = xval.addr;
+	if (XrmGetResource(xdb, "pmenu.iconTheme", "*", &type, &xval) == True)
+		config.icon_theme = xval.addr;
 }
 
 /* get options */
@@ -83,13 +368,58 @@ getoptions(int *argc, char ***argv)
 {
 	int ch;
 
-	while ((ch = getopt(*argc, *argv, "tw")) != -1) {
+	while ((ch = getopt(*argc, *argv, "aBCfgLMPR:r:sTtu:wx")) != -1) {
 		switch (ch) {
+		case 'a':
+			aflag = 1;
+			break;
+		case 'B':
+			Bflag = 1;
+			break;
+		case 'C':
+			Cflag = 1;
+			break;
+		case 'f':
+			fflag = 1;
+			break;
+		case 'g':
+			config.gestures = 1;
+			break;
+		case 'L':
+			Lflag = 1;
+			break;
+		case 'M':
+			Mflag = 1;
+			break;
+		case 'P':
+			config.pixel_cache = 1;
+			break;
+		case 'R':
+			if ((replayfp = fopen(optarg, "re")) == NULL)
+				err(1, "%s", optarg);
+			break;
+		case 'r':
+			if ((recordfp = fopen(optarg, "we")) == NULL)
+				err(1, "%s", optarg);
+			break;
+		case 's':
+			sflag = 1;
+			config.sticky = 1;
+			break;
+		case 'T':
+			Tflag = 1;
+			break;
 		case 't':
-			tflag = 1;
+			config.triangles = 1;
+			break;
+		case 'u':
+			usagefile = optarg;
 			break;
 		case 'w':
-			wflag = 1;
+			config.warp = 0;
+			break;
+		case 'x':
+			xflag = 1;
 			break;
 		default:
 			usage();
@@ -102,1301 +432,1279 @@ getoptions(int *argc, char ***argv)
 		usage();
 }
 
-/* get color from color string */
-static void
-ealloccolor(const char *s, XftColor *color)
+/* get local monotonic time in microseconds */
+static uint64_t
+getmicros(void)
 {
-	if(!XftColorAllocName(dpy, visual, colormap, s, color))
-		errx(1, "could not allocate color: %s", s);
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
-/* parse color string */
-static void
-parsefonts(const char *s)
+/* get index of the histogram bucket of a value */
+static size_t
+latbucket(uint64_t v)
 {
-	const char *p;
-	char buf[1024];
-	size_t nfont = 0;
-
-	dc.nfonts = 1;
-	for (p = s; *p; p++)
-		if (*p == ',')
-			dc.nfonts++;
-
-	if ((dc.fonts = calloc(dc.nfonts, sizeof *dc.fonts)) == NULL)
-		err(1, "calloc");
-
-	p = s;
-	while (*p != '\0') {
-		size_t i;
-
-		i = 0;
-		while (isspace(*p))
-			p++;
-		while (i < sizeof buf && *p != '\0' && *p != ',')
-			buf[i++] = *p++;
-		if (i >= sizeof buf)
-			errx(1, "font name too long");
-		if (*p == ',')
-			p++;
-		buf[i] = '\0';
-		if (nfont == 0)
-			if ((dc.pattern = FcNameParse((FcChar8 *)buf)) == NULL)
-				errx(1, "the first font in the cache must be loaded from a font string");
-		if ((dc.fonts[nfont++] = XftFontOpenName(dpy, screen, buf)) == NULL)
-			errx(1, "could not load font");
-	}
+	int msb;
+
+	if (v < (1 << LATSUBBITS))
+		return v;
+	if (v >= (uint64_t)1 << LATMAXBITS)
+		v = ((uint64_t)1 << LATMAXBITS) - 1;
+	for (msb = LATSUBBITS; (v >> (msb + 1)) != 0; msb++)
+		;
+	return ((size_t)(msb - LATSUBBITS + 1) << LATSUBBITS) +
+	       (v >> (msb - LATSUBBITS)) - (1 << LATSUBBITS);
 }
 
-/* init draw context */
-static void
-initdc(void)
+/* get lowest value of a histogram bucket */
+static uint64_t
+latbucketmin(size_t i)
 {
-	XGCValues values;
-	Pixmap pbg, pfg, pselbg, pselfg, separator;
-	unsigned long valuemask;
-
-	/* get color pixels */
-	ealloccolor(config.background_color,    &dc.normal[ColorBG]);
-	ealloccolor(config.foreground_color,    &dc.normal[ColorFG]);
-	ealloccolor(config.selbackground_color, &dc.selected[ColorBG]);
-	ealloccolor(config.selforeground_color, &dc.selected[ColorFG]);
-	ealloccolor(config.separator_color,     &dc.separator);
-	ealloccolor(config.border_color,        &dc.border);
-
-	/* parse fonts */
-	parsefonts(config.font);
-
-	/* create common GC */
-	values.arc_mode = ArcPieSlice;
-	values.line_width = config.separator_pixels;
-	valuemask = GCLineWidth | GCArcMode;
-	dc.gc = XCreateGC(dpy, rootwin, valuemask, &values);
-
-	/* create color source Pictures */
-	dc.pictattr.repeat = 1;
-	dc.pictattr.poly_edge = PolyEdgeSmooth;
-	pbg = XCreatePixmap(dpy, rootwin, 1, 1, depth);
-	pfg = XCreatePixmap(dpy, rootwin, 1, 1, depth);
-	pselbg = XCreatePixmap(dpy, rootwin, 1, 1, depth);
-	pselfg = XCreatePixmap(dpy, rootwin, 1, 1, depth);
-	separator = XCreatePixmap(dpy, rootwin, 1, 1, depth);
-	pie.bg = XRenderCreatePicture(dpy, pbg, xformat, CPRepeat, &dc.pictattr);
-	pie.fg = XRenderCreatePicture(dpy, pfg, xformat, CPRepeat, &dc.pictattr);
-	pie.selbg = XRenderCreatePicture(dpy, pselbg, xformat, CPRepeat, &dc.pictattr);
-	pie.selfg = XRenderCreatePicture(dpy, pselfg, xformat, CPRepeat, &dc.pictattr);
-	pie.separator = XRenderCreatePicture(dpy, separator, xformat, CPRepeat, &dc.pictattr);
-	XRenderFillRectangle(dpy, PictOpOver, pie.bg, &dc.normal[ColorBG].color, 0, 0, 1, 1);
-	XRenderFillRectangle(dpy, PictOpOver, pie.fg, &dc.normal[ColorFG].color, 0, 0, 1, 1);
-	XRenderFillRectangle(dpy, PictOpOver, pie.selbg, &dc.selected[ColorBG].color, 0, 0, 1, 1);
-	XRenderFillRectangle(dpy, PictOpOver, pie.selfg, &dc.selected[ColorFG].color, 0, 0, 1, 1);
-	XRenderFillRectangle(dpy, PictOpOver, pie.separator, &dc.separator.color, 0, 0, 1, 1);
-	XFreePixmap(dpy, pbg);
-	XFreePixmap(dpy, pfg);
-	XFreePixmap(dpy, pselbg);
-	XFreePixmap(dpy, pselfg);
-	XFreePixmap(dpy, separator);
+	int shift;
+
+	if (i < (1 << LATSUBBITS))
+		return i;
+	shift = (i >> LATSUBBITS) - 1;
+	return ((uint64_t)(i & ((1 << LATSUBBITS) - 1)) + (1 << LATSUBBITS)) << shift;
 }
 
-/* setup pie */
+/* add a latency, in microseconds, to the histogram of kind */
 static void
-initpie(void)
+latrecord(int kind, int64_t latency)
 {
-	XGCValues values;
-	unsigned long valuemask;
-
-	/* set pie geometry */
-	pie.border = config.border_pixels;
-	pie.diameter = config.diameter_pixels;
-	pie.radius = (pie.diameter + 1) / 2;
-	pie.fulldiameter = pie.diameter + (pie.border * 2);
-
-	/* set the geometry of the triangle for submenus */
-	pie.triangleouter = pie.radius - config.triangle_distance;
-	pie.triangleinner = pie.radius - config.triangle_distance - config.triangle_width;
-	pie.triangleangle = ((double)config.triangle_height / 2.0) / (double)pie.triangleinner;
-
-	/* set the separator beginning and end */
-	pie.separatorbeg = pie.radius * config.separatorbeg;
-	pie.separatorend = pie.radius * config.separatorend;
-    pie.centerdiskradius = (pie.radius + 1) * config.centerdiskradius;
-	pie.innerangle = atan(config.separator_pixels / (2.0 * pie.separatorbeg));
-	pie.outerangle = atan(config.separator_pixels / (2.0 * pie.separatorend));
-
-	/* Create a simple bitmap mask (depth = 1) */
-	pie.clip = XCreatePixmap(dpy, rootwin, pie.diameter, pie.diameter, 1);
-	pie.bounding = XCreatePixmap(dpy, rootwin, pie.fulldiameter, pie.fulldiameter, 1);
-
-	/* Create the mask GC */
-	values.background = 1;
-	values.arc_mode = ArcPieSlice;
-	valuemask = GCBackground | GCArcMode;
-	pie.gc = XCreateGC(dpy, pie.clip, valuemask, &values);
-
-	/* clear the bitmap */
-	XSetForeground(dpy, pie.gc, 0);
-	XFillRectangle(dpy, pie.clip, pie.gc, 0, 0, pie.diameter, pie.diameter);
-	XFillRectangle(dpy, pie.bounding, pie.gc, 0, 0, pie.fulldiameter, pie.fulldiameter);
-
-	/* create round shape */
-	XSetForeground(dpy, pie.gc, 1);
-	XFillArc(dpy, pie.clip, pie.gc, 0, 0,
-	         pie.diameter, pie.diameter, 0, 360*64);
-	XFillArc(dpy, pie.bounding, pie.gc, 0, 0,
-	         pie.fulldiameter, pie.fulldiameter, 0, 360*64);
+	struct Histogram *h;
+	uint64_t v;
+
+	h = &histograms[kind];
+	v = latency > 0 ? latency : 0;
+	if (h->count == 0 || v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+	h->sum += v;
+	h->count++;
+	h->buckets[latbucket(v)]++;
 }
 
-/* call strdup checking for error */
-static char *
-estrdup(const char *s)
+/* get value at given quantile of a histogram */
+static uint64_t
+latquantile(struct Histogram *h, double q)
 {
-	char *t;
+	unsigned long n, target;
+	size_t i;
 
-	if ((t = strdup(s)) == NULL)
-		err(1, "strdup");
-	return t;
+	target = q * h->count;
+	for (n = 0, i = 0; i < LATBUCKETS; i++)
+		if ((n += h->buckets[i]) > target)
+			return MIN(MAX(latbucketmin(i), h->min), h->max);
+	return h->max;
 }
 
-/* call malloc checking for error */
-static void *
-emalloc(size_t size)
+/* print latency histograms, if -L was given */
+static void
+printlatency(void)
 {
-	void *p;
+	static const char *names[LatencyLast] = {
+		[LatencySelect]  = "selection change",
+		[LatencySubmenu] = "submenu open",
+		[LatencyNoop]    = "no-op",
+	};
+	struct Histogram *h;
+	size_t i;
+	int kind;
 
-	if ((p = malloc(size)) == NULL)
-		err(1, "malloc");
-	return p;
+	if (!Lflag)
+		return;
+	for (kind = 0; kind < LatencyLast; kind++) {
+		h = &histograms[kind];
+		(void)fprintf(stderr, "%s: %s: count=%lu", PROGNAME, names[kind], h->count);
+		if (h->count == 0) {
+			(void)fprintf(stderr, "\n");
+			continue;
+		}
+		(void)fprintf(stderr,
+		              " min=%.3fms mean=%.3fms p50=%.3fms p90=%.3fms p99=%.3fms max=%.3fms\n",
+		              h->min / 1e3, (double)h->sum / h->count / 1e3,
+		              latquantile(h, 0.50) / 1e3, latquantile(h, 0.90) / 1e3,
+		              latquantile(h, 0.99) / 1e3, h->max / 1e3);
+		for (i = 0; i < LATBUCKETS; i++)
+			if (h->buckets[i] != 0)
+				(void)fprintf(stderr, "%s:   >= %10.3fms %lu\n", PROGNAME,
+				              latbucketmin(i) / 1e3, h->buckets[i]);
+	}
 }
 
-/* allocate an slice */
-static struct Slice *
-allocslice(const char *label, const char *output, char *file)
+/* ask for the latency histograms to be printed */
+static void
+sigusr1(int sig)
 {
-	struct Slice *slice;
-
-	slice = emalloc(sizeof *slice);
-	slice->label = label ? estrdup(label) : NULL;
-	slice->output = (label == output) ? slice->label : estrdup(output);
-	slice->file = file ? estrdup(file) : NULL;
-	slice->y = 0;
-	slice->labellen = (slice->label) ? strlen(slice->label) : 0;
-	slice->next = NULL;
-	slice->submenu = NULL;
-	slice->icon = NULL;
-
-	return slice;
+	(void)sig;
+	dumplatency = 1;
 }
 
-/* allocate a menu */
-static struct Menu *
-allocmenu(struct Menu *parent, struct Slice *list, unsigned level)
+/* start recording latencies, if -L was given */
+static void
+initlatency(void)
 {
-	XSetWindowAttributes swa;
-	XClassHint classh = {PROGNAME, PROGNAME};
-	XSizeHints sizeh;
-	struct Menu *menu;
+	struct sigaction sa;
 
-	menu = emalloc(sizeof *menu);
-
-	/* create menu window */
-	swa.override_redirect = True;
-	swa.background_pixel = dc.normal[ColorBG].pixel;
-	swa.border_pixel = dc.border.pixel;
-	swa.save_under = True;  /* pop-up windows should save_under*/
-	swa.event_mask = ExposureMask | KeyPressMask | ButtonPressMask | ButtonReleaseMask
-	               | PointerMotionMask | EnterWindowMask | LeaveWindowMask;
-	menu->win = XCreateWindow(dpy, rootwin, 0, 0, pie.diameter, pie.diameter, pie.border,
-	                          CopyFromParent, CopyFromParent, CopyFromParent,
-	                          CWOverrideRedirect | CWBackPixel |
-	                          CWBorderPixel | CWEventMask | CWSaveUnder,
-	                          &swa);
-
-	XShapeCombineMask(dpy, menu->win, ShapeClip, 0, 0, pie.clip, ShapeSet);
-	XShapeCombineMask(dpy, menu->win, ShapeBounding, -pie.border, -pie.border, pie.bounding, ShapeSet);
-
-	/* set window manager hints */
-	sizeh.flags = USPosition | PMaxSize | PMinSize;
-	sizeh.min_width = sizeh.max_width = pie.diameter;
-	sizeh.min_height = sizeh.max_height = pie.diameter;
-	XSetWMProperties(dpy, menu->win, NULL, NULL, NULL, 0, &sizeh, NULL, &classh);
-
-	/* set menu variables */
-	menu->parent = parent;
-	menu->list = list;
-	menu->caller = NULL;
-	menu->selected = NULL;
-	menu->nslices = 0;
-	menu->x = 0;    /* calculated by setupmenu() */
-	menu->y = 0;    /* calculated by setupmenu() */
-	menu->level = level;
-
-	/* create pixmap and picture */
-	menu->pixmap = XCreatePixmap(dpy, menu->win, pie.diameter, pie.diameter, depth);
-	menu->picture = XRenderCreatePicture(dpy, menu->pixmap, xformat, CPPolyEdge | CPRepeat, &dc.pictattr);
-	menu->drawn = 0;
-
-	return menu;
+	if (!Lflag)
+		return;
+	sa.sa_handler = sigusr1;
+	sa.sa_flags = 0;    /* no SA_RESTART, so the event loop wakes up */
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGUSR1, &sa, NULL) == -1)
+		err(1, "sigaction");
 }
 
-/* build the menu tree */
-static struct Menu *
-buildmenutree(unsigned level, const char *label, const char *output, char *file)
+/* get server time of an input event, in milliseconds */
+static Time
+eventtime(XEvent *ev)
 {
-	static struct Menu *prevmenu = NULL;    /* menu the previous slice was added to */
-	static struct Menu *rootmenu = NULL;    /* menu to be returned */
-	struct Slice *currslice = NULL;           /* slice currently being read */
-	struct Slice *slice;                      /* dummy slice for loops */
-	struct Menu *menu;                      /* dummy menu for loops */
-	unsigned i;
-
-	/* create the slice */
-	currslice = allocslice(label, output, file);
-
-	/* put the slice in the menu tree */
-	if (prevmenu == NULL) {                 /* there is no menu yet */
-		menu = allocmenu(NULL, currslice, level);
-		rootmenu = menu;
-		prevmenu = menu;
-		currslice->prev = NULL;
-	} else if (level < prevmenu->level) {   /* slice is continuation of a parent menu */
-		/* go up the menu tree until find the menu this slice continues */
-		for (menu = prevmenu, i = level;
-			  menu != NULL && i != prevmenu->level;
-			  menu = menu->parent, i++)
-			;
-		if (menu == NULL)
-			errx(1, "improper indentation detected");
-
-		/* find last slice in the new menu */
-		for (slice = menu->list; slice->next != NULL; slice = slice->next)
-			;
-
-		prevmenu = menu;
-		slice->next = currslice;
-		currslice->prev = slice;
-	} else if (level == prevmenu->level) {  /* slice is a continuation of current menu */
-		/* find last slice in the previous menu */
-		for (slice = prevmenu->list; slice->next != NULL; slice = slice->next)
-			;
-
-		slice->next = currslice;
-		currslice->prev = slice;
-	} else if (level > prevmenu->level) {   /* slice begins a new menu */
-		menu = allocmenu(prevmenu, currslice, level);
-
-		/* find last slice in the previous menu */
-		for (slice = prevmenu->list; slice->next != NULL; slice = slice->next)
-			;
-
-		prevmenu = menu;
-		menu->caller = slice;
-		slice->submenu = menu;
-		currslice->prev = NULL;
+	switch (ev->type) {
+	case MotionNotify:
+		return ev->xmotion.time;
+	case ButtonPress:
+	case ButtonRelease:
+		return ev->xbutton.time;
+	case KeyPress:
+		return ev->xkey.time;
 	}
-
-	prevmenu->nslices++;
-
-	return rootmenu;
+	return CurrentTime;
 }
 
-/* create menus and slices from the stdin */
-static struct Menu *
-parsestdin(void)
+/*
+ * Widen a server time in milliseconds, which wraps every 49.7 days, to
+ * microseconds in the wrap nearest to the given server time.
+ */
+static uint64_t
+unwraptime(Time time, uint64_t near)
 {
-	struct Menu *rootmenu;
-	char *s, buf[BUFSIZ];
-	char *file, *label, *output;
-	unsigned level = 0;
-
-	rootmenu = NULL;
-
-	while (fgets(buf, BUFSIZ, stdin) != NULL) {
-		/* get the indentation level */
-		level = strspn(buf, "\t");
+	uint64_t ms = near / 1000;
 
-		/* get the label */
-		s = level + buf;
-		label = strtok(s, "\t\n");
-
-		if (label == NULL)
-			errx(1, "empty item");
+	return (ms + (int32_t)((uint32_t)time - (uint32_t)ms)) * 1000;
+}
 
-		/* get the filename */
-		file = NULL;
-		if (label != NULL && strncmp(label, "IMG:", 4) == 0) {
-			file = label + 4;
-			label = NULL;
-		}
+/*
+ * Record the latency of an input event handled with the given kind of
+ * response.  If the response drew a frame, its latency runs until the
+ * frame is presented: with Present, until the complete notify of that
+ * frame (or of a later one that replaced it), otherwise until an XSync().
+ * The offset between the local and the server clocks is estimated as the
+ * smallest difference seen between receiving an event and its timestamp;
+ * the timestamp is unwrapped against the server time it estimates.
+ */
+static void
+latency(XEvent *ev, int kind, int framed, uint64_t received)
+{
+	uint64_t time;
+	int64_t offset;
 
-		/* get the output */
-		output = strtok(NULL, "\n");
-		if (output == NULL) {
-			output = label;
-		} else {
-			while (*output == '\t')
-				output++;
+	if (!Lflag || eventtime(ev) == CurrentTime)
+		return;
+	if (clockoffset == INT64_MAX)
+		time = (uint64_t)eventtime(ev) * 1000;
+	else
+		time = unwraptime(eventtime(ev), received - clockoffset);
+	offset = received - time;
+	if (offset < clockoffset)
+		clockoffset = offset;
+	if (framed && pm->presentopcode != 0) {
+		if (npending == LATPENDING) {
+			/* lost completion events; drop the oldest input */
+			memmove(pending, pending + 1, --npending * sizeof *pending);
 		}
-
-		rootmenu = buildmenutree(level, label, output, file);
+		pending[npending].time = time;
+		pending[npending].serial = pm->presentserial;
+		pending[npending].kind = kind;
+		npending++;
+		return;
 	}
-
-	return rootmenu;
+	if (framed)
+		XSync(dpy, False);
+	latrecord(kind, getmicros() - clockoffset - time);
 }
 
-/* load image from file and scale it to size; return the image and its size */
-static Imlib_Image
-loadicon(const char *file, int size, int *width_ret, int *height_ret)
+/* record the latency of inputs whose frame has been presented */
+static void
+latencypresented(void *arg, uint32_t serial, uint64_t ust)
 {
-	Imlib_Image icon;
-	Imlib_Load_Error errcode;
-	const char *errstr;
-	int width;
-	int height;
-
-	icon = imlib_load_image_with_error_return(file, &errcode);
-	if (*file == '\0') {
-		errx(1, "could not load icon (file name is blank)");
-	} else if (icon == NULL) {
-		switch (errcode) {
-		case IMLIB_LOAD_ERROR_FILE_DOES_NOT_EXIST:
-			errstr = "file does not exist";
-			break;
-		case IMLIB_LOAD_ERROR_FILE_IS_DIRECTORY:
-			errstr = "file is directory";
-			break;
-		case IMLIB_LOAD_ERROR_PERMISSION_DENIED_TO_READ:
-		case IMLIB_LOAD_ERROR_PERMISSION_DENIED_TO_WRITE:
-			errstr = "permission denied";
-			break;
-		case IMLIB_LOAD_ERROR_NO_LOADER_FOR_FILE_FORMAT:
-			errstr = "unknown file format";
-			break;
-		case IMLIB_LOAD_ERROR_PATH_TOO_LONG:
-			errstr = "path too long";
-			break;
-		case IMLIB_LOAD_ERROR_PATH_COMPONENT_NON_EXISTANT:
-		case IMLIB_LOAD_ERROR_PATH_COMPONENT_NOT_DIRECTORY:
-		case IMLIB_LOAD_ERROR_PATH_POINTS_OUTSIDE_ADDRESS_SPACE:
-			errstr = "improper path";
-			break;
-		case IMLIB_LOAD_ERROR_TOO_MANY_SYMBOLIC_LINKS:
-			errstr = "too many symbolic links";
-			break;
-		case IMLIB_LOAD_ERROR_OUT_OF_MEMORY:
-			errstr = "out of memory";
-			break;
-		case IMLIB_LOAD_ERROR_OUT_OF_FILE_DESCRIPTORS:
-			errstr = "out of file descriptors";
-			break;
-		default:
-			errstr = "unknown error";
-			break;
-		}
-		errx(1, "could not load icon (%s): %s", errstr, file);
+	size_t i, n;
+
+	(void)arg;
+	for (i = n = 0; i < npending; i++) {
+		if ((int32_t)(serial - pending[i].serial) >= 0)
+			latrecord(pending[i].kind,
+			          ust - unwraptime(pending[i].time / 1000, ust));
+		else
+			pending[n++] = pending[i];
 	}
-
-	imlib_context_set_image(icon);
-
-	width = imlib_image_get_width();
-	height = imlib_image_get_height();
-
-	if (width > height) {
-		*width_ret = size;
-		*height_ret = (height * size) / width;
-	} else {
-		*width_ret = (width * size) / height;
-		*height_ret = size;
-	}
-
-	icon = imlib_create_cropped_scaled_image(0, 0, width, height,
-	                                         *width_ret, *height_ret);
-
-	return icon;
+	npending = n;
 }
 
-/* get next utf8 char from s return its codepoint and set next_ret to pointer to end of character */
-static FcChar32
-getnextutf8char(const char *s, const char **next_ret)
+/*
+ * Parse stdin on its own thread, while the main thread sets up X; return
+ * the tree, or NULL on error for the main thread to exit after joining.
+ */
+static void *
+parsethread(void *arg)
 {
-	static const unsigned char utfbyte[] = {0x80, 0x00, 0xC0, 0xE0, 0xF0};
-	static const unsigned char utfmask[] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
-	static const FcChar32 utfmin[] = {0, 0x00,  0x80,  0x800,  0x10000};
-	static const FcChar32 utfmax[] = {0, 0x7F, 0x7FF, 0xFFFF, 0x10FFFF};
-	/* 0xFFFD is the replacement character, used to represent unknown characters */
-	static const FcChar32 unknown = 0xFFFD;
-	FcChar32 ucode;         /* FcChar32 type holds 32 bits */
-	size_t usize = 0;       /* n' of bytes of the utf8 character */
-	size_t i;
-
-	*next_ret = s+1;
-
-	/* get code of first byte of utf8 character */
-	for (i = 0; i < sizeof utfmask; i++) {
-		if (((unsigned char)*s & utfmask[i]) == utfbyte[i]) {
-			usize = i;
-			ucode = (unsigned char)*s & ~utfmask[i];
-			break;
-		}
-	}
-
-	/* if first byte is a continuation byte or is not allowed, return unknown */
-	if (i == sizeof utfmask || usize == 0)
-		return unknown;
-
-	/* check the other usize-1 bytes */
-	s++;
-	for (i = 1; i < usize; i++) {
-		*next_ret = s+1;
-		/* if byte is nul or is not a continuation byte, return unknown */
-		if (*s == '\0' || ((unsigned char)*s & utfmask[0]) != utfbyte[0])
-			return unknown;
-		/* 6 is the number of relevant bits in the continuation byte */
-		ucode = (ucode << 6) | ((unsigned char)*s & ~utfmask[0]);
-		s++;
-	}
-
-	/* check if ucode is invalid or in utf-16 surrogate halves */
-	if (!BETWEEN(ucode, utfmin[usize], utfmax[usize])
-	    || BETWEEN (ucode, 0xD800, 0xDFFF))
-		return unknown;
-
-	return ucode;
+	struct PMenuTree *tree = arg;
+	uint64_t start;
+	int ret;
+
+	timing("parsing started");
+	start = getmicros();
+	if (aflag)
+		ret = pmenu_tree_apps(tree);
+	else
+		ret = pmenu_tree_parse(tree, stdin);
+	parsetime = getmicros() - start;
+	timing("parsing finished");
+	return (ret == -1) ? NULL : tree;
 }
 
-/* get which font contains a given code point */
-static XftFont *
-getfontucode(FcChar32 ucode)
+/* send the request to grab the pointer; strokes of gestures go outside the menus */
+static xcb_grab_pointer_cookie_t
+grabpointer(void)
 {
-	FcCharSet *fccharset = NULL;
-	FcPattern *fcpattern = NULL;
-	FcPattern *match = NULL;
-	XftFont *retfont = NULL;
-	XftResult result;
-	size_t i;
-
-	for (i = 0; i < dc.nfonts; i++)
-		if (XftCharExists(dpy, dc.fonts[i], ucode) == FcTrue)
-			return dc.fonts[i];
+	uint16_t mask = XCB_EVENT_MASK_BUTTON_PRESS;
+
+	if (config.gestures)
+		mask |= XCB_EVENT_MASK_BUTTON_RELEASE | XCB_EVENT_MASK_POINTER_MOTION;
+	xcbbytes += XCBBYTES(xcb_grab_pointer_request_t, 0);
+	return xcb_grab_pointer(xconn, True, rootwin, mask,
+	                        XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC, XCB_NONE,
+	                        XCB_NONE, XCB_CURRENT_TIME);
+}
 
-	/* create a charset containing our code point */
-	fccharset = FcCharSetCreate();
-	FcCharSetAddChar(fccharset, ucode);
+/* send the request to grab the keyboard */
+static xcb_grab_keyboard_cookie_t
+grabkeyboard(void)
+{
+	xcbbytes += XCBBYTES(xcb_grab_keyboard_request_t, 0);
+	return xcb_grab_keyboard(xconn, True, rootwin, XCB_CURRENT_TIME,
+	                         XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+}
 
-	/* create a pattern akin to the dc.pattern but containing our charset */
-	if (fccharset) {
-		fcpattern = FcPatternDuplicate(dc.pattern);
-		FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
+/*
+ * Check the replies to the grabs without blocking, and resend the grabs
+ * that failed once their backoff expires; another process may still hold
+ * them, as the hotkey daemon that started us.  Input is only handled
+ * once both grabs are acquired.  Return whether a reply was read.
+ */
+static int
+pollgrab(void)
+{
+	xcb_grab_pointer_reply_t *preply;
+	xcb_grab_keyboard_reply_t *kreply;
+	xcb_generic_error_t *error;
+	char buf[64];
+	uint64_t now;
+	int replied;
+
+	if (grabbed.done)
+		return 0;
+	replied = 0;
+	if (grabbed.ppending && xcb_poll_for_reply(xconn, grabbed.pcookie.sequence,
+	                                           (void **)&preply, &error)) {
+		grabbed.ppending = 0;
+		replied = 1;
+		grabbed.pointer = preply != NULL && preply->status == XCB_GRAB_STATUS_SUCCESS;
+		free(preply);
+		free(error);
 	}
-
-	/* find pattern matching fcpattern */
-	if (fcpattern) {
-		FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
-		FcDefaultSubstitute(fcpattern);
-		match = XftFontMatch(dpy, screen, fcpattern, &result);
+	if (grabbed.kpending && xcb_poll_for_reply(xconn, grabbed.kcookie.sequence,
+	                                           (void **)&kreply, &error)) {
+		grabbed.kpending = 0;
+		replied = 1;
+		grabbed.keyboard = kreply != NULL && kreply->status == XCB_GRAB_STATUS_SUCCESS;
+		free(kreply);
+		free(error);
 	}
-
-	/* if found a pattern, open its font */
-	if (match) {
-		retfont = XftFontOpenPattern(dpy, match);
-		if (retfont && XftCharExists(dpy, retfont, ucode) == FcTrue) {
-			if ((dc.fonts = realloc(dc.fonts, dc.nfonts+1)) == NULL)
-				err(1, "realloc");
-			dc.fonts[dc.nfonts] = retfont;
-			return dc.fonts[dc.nfonts++];
-		} else {
-			XftFontClose(dpy, retfont);
-		}
+	now = getmicros();
+	if (grabbed.pointer && grabbed.keyboard) {
+		grabbed.done = 1;
+		grabbed.wait = now - grabbed.start;
+		snprintf(buf, sizeof(buf), "grabbed after %.3fms and %d retries",
+		         grabbed.wait / 1e3, grabbed.retries);
+		timing(buf);
+		return replied;
+	}
+	if (grabbed.ppending || grabbed.kpending)
+		return replied;
+	if (now - grabbed.start > GRABTIMEOUT)
+		errx(1, "could not grab %s", grabbed.pointer ? "keyboard" : "pointer");
+	if (grabbed.retry == 0) {
+		grabbed.backoff = grabbed.backoff ? MIN(grabbed.backoff * 2, GRABBACKOFFMAX) : GRABBACKOFF;
+		grabbed.retry = now + grabbed.backoff;
 	}
+	if (now < grabbed.retry)
+		return replied;
+
+	/* resend only the grabs that failed, both at once */
+	grabbed.retry = 0;
+	grabbed.retries++;
+	if (!grabbed.pointer) {
+		grabbed.pcookie = grabpointer();
+		grabbed.ppending = 1;
+	}
+	if (!grabbed.keyboard) {
+		grabbed.kcookie = grabkeyboard();
+		grabbed.kpending = 1;
+	}
+	xcb_flush(xconn);
+	return replied;
+}
 
-	/* in case no fount was found, return the first one */
-	return dc.fonts[0];
+/* send the grabs; their replies are checked by pollgrab() */
+static void
+grab(void)
+{
+	memset(&grabbed, 0, sizeof(grabbed));
+	grabbed.start = getmicros();
+	grabbed.pcookie = grabpointer();
+	grabbed.kcookie = grabkeyboard();
+	grabbed.ppending = grabbed.kpending = 1;
 }
 
-/* draw text into XftDraw */
+/*
+ * Milliseconds until the grabs must be retried, -1 if they need not or
+ * while a reply is awaited, as its arrival makes the connection readable.
+ */
 static int
-drawtext(XftDraw *draw, XftColor *color, int x, int y, const char *text)
+grabtimeout(void)
 {
-	int textwidth = 0;
+	uint64_t now;
+
+	if (grabbed.done || grabbed.ppending || grabbed.kpending)
+		return -1;
+	if (grabbed.retry == 0)
+		return 0;
+	now = getmicros();
+	return now >= grabbed.retry ? 0 : (grabbed.retry - now + 999) / 1000;
+}
 
-	while (*text) {
-		XftFont *currfont;
-		XGlyphInfo ext;
-		FcChar32 ucode;
-		const char *next;
-		size_t len;
+/* block until both grabs are acquired */
+static void
+waitgrab(void)
+{
+	struct pollfd pfd;
 
-		ucode = getnextutf8char(text, &next);
-		currfont = getfontucode(ucode);
+	pfd.fd = ConnectionNumber(dpy);
+	pfd.events = POLLIN;
+	for (pollgrab(); !grabbed.done; pollgrab())
+		if (poll(&pfd, 1, grabtimeout()) == -1 && errno != EINTR)
+			err(1, "poll");
+}
 
-		len = next - text;
-		XftTextExtentsUtf8(dpy, currfont, (XftChar8 *)text, len, &ext);
-		textwidth += ext.xOff;
+/* ungrab pointer and keyboard */
+static void
+ungrab(void)
+{
+	XUngrabPointer(dpy, CurrentTime);
+	XUngrabKeyboard(dpy, CurrentTime);
+}
 
-		if (draw) {
-			int texty;
+/* decode the labels of the menu tree; return the number of characters */
+static unsigned long
+benchutf8(struct Menu *menu)
+{
+	struct Slice *slice;
+	FcChar32 *ucs;
+	size_t len;
+	int invalid;
+	unsigned long n = 0;
 
-			texty = y + (currfont->ascent - currfont->descent)/2;
-			XftDrawStringUtf8(draw, color, currfont, x, texty, (XftChar8 *)text, len);
-			x += ext.xOff;
+	for (slice = menu->list; slice != NULL; slice = slice->next) {
+		if (slice->label != NULL) {
+			if ((ucs = pmenu_utf8decode(slice->label, &len, &invalid)) == NULL)
+				exit(1);
+			benchsink += len > 0 ? ucs[len - 1] : 0;
+			n += len;
+			free(ucs);
 		}
-
-		text = next;
+		if (slice->submenu != NULL)
+			n += benchutf8(slice->submenu);
 	}
-
-	return textwidth;
+	return n;
 }
 
-/* setup position of and content of menu's slices */
-/* recursivelly setup menu configuration and its pixmap */
-static void
-setslices(struct Menu *menu)
+/* measure the labels of the menu tree; return the number of labels */
+static unsigned long
+benchmeasure(struct Menu *menu)
 {
 	struct Slice *slice;
-	double a = 0.0;
-	unsigned n = 0;
-	int textwidth;
-
-	menu->half = M_PI / menu->nslices;
-	for (slice = menu->list; slice; slice = slice->next) {
-		slice->slicen = n++;
-
-		slice->anglea = a - menu->half;
-		slice->angleb = a + menu->half;
-
-		/* get length of slice->label rendered in the font */
-		textwidth = (slice->label) ? drawtext(NULL, NULL, 0, 0, slice->label): 0;
-
-		/* get position of slice's label */
-		slice->labelx = pie.radius + ((pie.radius*2)/3 * cos(a)) - (textwidth / 2);
-		slice->labely = pie.radius - ((pie.radius*2)/3 * sin(a));
-
-		/* get position of submenu */
-		slice->x = pie.radius + (pie.diameter * (cos(a) * 0.9));
-		slice->y = pie.radius - (pie.diameter * (sin(a) * 0.9));
-
-		/* create icon */
-		if (slice->file != NULL) {
-			int maxiconsize = (pie.radius + 1) / 2;
-			int iconw, iconh;       /* icon width and height */
-			int iconsize;           /* requested icon size */
-			int xdiff, ydiff;
-
-			xdiff = pie.radius * 0.5 - (pie.radius * (cos(menu->half) * 0.8));
-			ydiff = pie.radius * (sin(menu->half) * 0.8);
-
-			iconsize = sqrt(xdiff * xdiff + ydiff * ydiff);
-			iconsize = MIN(maxiconsize, iconsize);
-
-			slice->icon = loadicon(slice->file, iconsize, &iconw, &iconh);
-
-			slice->iconx = pie.radius + (pie.radius * (cos(a) * 0.6)) - iconw / 2;
-			slice->icony = pie.radius - (pie.radius * (sin(a) * 0.6)) - iconh / 2;
-		}
+	unsigned long n = 0;
 
-		/* create and draw pixmap */
-		slice->pixmap = XCreatePixmap(dpy, menu->win, pie.diameter, pie.diameter, depth);
-		slice->picture = XRenderCreatePicture(dpy, slice->pixmap, xformat, CPPolyEdge | CPRepeat, &dc.pictattr);
-		slice->drawn = 0;
-
-		/* call recursivelly */
-		if (slice->submenu != NULL) {
-			setslices(slice->submenu);
+	for (slice = menu->list; slice != NULL; slice = slice->next) {
+		if (slice->label != NULL) {
+			benchsink += pmenu_textwidth(pm, slice->ucs, slice->ucslen);
+			n++;
 		}
-
-		a += menu->half * 2;
+		if (slice->submenu != NULL)
+			n += benchmeasure(slice->submenu);
 	}
+	return n;
 }
 
-/* query monitor information and cursor position */
-static void
-getmonitor(void)
+/* lay out the menu tree; return the number of slices */
+static unsigned long
+benchlayout(struct Menu *menu)
 {
-	XineramaScreenInfo *info = NULL;
-	Window dw;          /* dummy variable */
-	int di;             /* dummy variable */
-	unsigned du;        /* dummy variable */
-	int nmons;
-	int i;
-
-	XQueryPointer(dpy, rootwin, &dw, &dw, &mon.cursx, &mon.cursy, &di, &di, &du);
-
-	mon.x = mon.y = 0;
-	mon.w = DisplayWidth(dpy, screen);
-	mon.h = DisplayHeight(dpy, screen);
+	struct Slice *slice;
+	unsigned long n;
 
-	if ((info = XineramaQueryScreens(dpy, &nmons)) != NULL) {
-		int selmon = 0;
+	pmenu_layout(pm, menu);
+	n = menu->nslices;
+	for (slice = menu->list; slice != NULL; slice = slice->next)
+		if (slice->submenu != NULL)
+			n += benchlayout(slice->submenu);
+	return n;
+}
 
-		for (i = 0; i < nmons; i++) {
-			if (BETWEEN(mon.cursx, info[i].x_org, info[i].x_org + info[i].width) &&
-			    BETWEEN(mon.cursy, info[i].y_org, info[i].y_org + info[i].height)) {
-				selmon = i;
-				break;
-			}
+/* get the slices on a grid over each laid out menu; return the number of points */
+static unsigned long
+benchgetslice(struct Menu *menu)
+{
+	struct Slice *slice;
+	unsigned long n = 0;
+	int x, y, step;
+
+	step = MAX(pm->pie.diameter / 16, 1);
+	for (y = 0; y < pm->pie.diameter; y += step) {
+		for (x = 0; x < pm->pie.diameter; x += step) {
+			benchsink += (pmenu_getslice(pm, menu, x, y) != NULL);
+			n++;
 		}
-
-		mon.x = info[selmon].x_org;
-		mon.y = info[selmon].y_org;
-		mon.w = info[selmon].width;
-		mon.h = info[selmon].height;
-
-		XFree(info);
 	}
+	for (slice = menu->list; slice != NULL; slice = slice->next)
+		if (slice->submenu != NULL)
+			n += benchgetslice(slice->submenu);
+	return n;
 }
 
-/* try to grab pointer, we may have to wait for another process to ungrab */
+/* run a benchmark stage over the menu tree for at least 100ms and report it */
 static void
-grabpointer(void)
+benchstage(struct Menu *rootmenu, const char *name, unsigned long (*stage)(struct Menu *))
 {
-	struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000  };
-	int i;
-
-	for (i = 0; i < 1000; i++) {
-		if (XGrabPointer(dpy, rootwin, True, ButtonPressMask,
-		                 GrabModeAsync, GrabModeAsync, None,
-		                 None, CurrentTime) == GrabSuccess)
-			return;
-		nanosleep(&ts, NULL);
-	}
-	errx(1, "could not grab pointer");
+	unsigned long items, rounds = 0;
+	uint64_t start, elapsed;
+
+	start = getmicros();
+	do {
+		items = stage(rootmenu);
+		rounds++;
+	} while ((elapsed = getmicros() - start) < 100000);
+	(void)fprintf(stderr, "%s: bench %-10s %10lu items %12.3fms/round %10.1fns/item\n",
+	              PROGNAME, name, items, elapsed / 1e3 / rounds,
+	              elapsed * 1e3 / rounds / MAX(items, 1));
 }
 
-/* try to grab keyboard, we may have to wait for another process to ungrab */
+/* benchmark each stage of the menu setup without creating any window */
 static void
-grabkeyboard(void)
+benchmark(struct Menu *rootmenu)
 {
-	struct timespec ts = { .tv_sec = 0, .tv_nsec = 1000000  };
-	int i;
-
-	for (i = 0; i < 1000; i++) {
-		if (XGrabKeyboard(dpy, rootwin, True, GrabModeAsync,
-		                  GrabModeAsync, CurrentTime) == GrabSuccess)
-			return;
-		nanosleep(&ts, NULL);
-	}
-	errx(1, "could not grab keyboard");
+	unsigned long nslices;
+
+	nslices = benchlayout(rootmenu);
+	(void)fprintf(stderr, "%s: bench %-10s %10lu items %12.3fms/round %10.1fns/item\n",
+	              PROGNAME, "parse", nslices, parsetime / 1e3,
+	              parsetime * 1e3 / MAX(nslices, 1));
+	benchstage(rootmenu, "utf8", benchutf8);
+	benchstage(rootmenu, "measure", benchmeasure);
+	benchstage(rootmenu, "layout", benchlayout);
+	benchstage(rootmenu, "getslice", benchgetslice);
 }
 
-/* setup the position of a menu */
+/* write the path of a menu from the root, like "/2/0", into buf */
 static void
-placemenu(struct Menu *menu)
+getmenupath(struct Menu *menu, char *buf, size_t size)
 {
 	struct Slice *slice;
-	XWindowChanges changes;
-	Window w1;  /* dummy variable */
-	int x, y;   /* position of the center of the menu */
-	Bool ret;
-
-	/*if (menu->parent == NULL) {*/
-		x = mon.cursx;
-		y = mon.cursy;
-	/*} else {*/
-		/*ret = XTranslateCoordinates(dpy, menu->parent->win, rootwin,*/
-									/*menu->caller->x, menu->caller->y,*/
-									/*&x, &y, &w1);*/
-		/*if (ret == False)*/
-			/*errx(EXIT_FAILURE, "menus are on different screens");*/
-	/*}*/
-	menu->x = mon.x; /* origin of monitor */
-	menu->y = mon.y; /* origin of monitor */
-	if (x - mon.x >= pie.radius) {
-		if (mon.x + mon.w - x >= pie.radius) {
-			menu->x = x - pie.radius - pie.border;
-        }
-		else if (mon.x + mon.w >= pie.fulldiameter) {
-			menu->x = mon.x + mon.w - pie.fulldiameter - 1;
-        }
-	}
-	if (y - mon.y >= pie.radius) {
-		if (mon.y + mon.h - y >= pie.radius) {
-			menu->y = y - pie.radius - pie.border + 1;
-        }
-		else if (mon.y + mon.h >= pie.fulldiameter) {
-			menu->y = mon.y + mon.h - pie.fulldiameter;
-        }
+	char tmp[BUFSIZ];
+	unsigned n;
+
+	if (menu == NULL) {
+		(void)snprintf(buf, size, "-");
+		return;
 	}
-	changes.x = menu->x;
-	changes.y = menu->y;
-	XConfigureWindow(dpy, menu->win, CWX | CWY, &changes);
-    if(menu->parent == NULL) {
-        XWarpPointer(dpy, None, menu->win, 0, 0, 0, 0, pie.radius, pie.radius);
-    }
-	for (slice = menu->list; slice != NULL; slice = slice->next) {
-		if (slice->submenu != NULL) {
-			placemenu(slice->submenu);
-		}
+	buf[0] = '\0';
+	for (; menu->parent != NULL; menu = menu->parent) {
+		for (n = 0, slice = menu->parent->list; slice != menu->caller; slice = slice->next)
+			n++;
+		(void)snprintf(tmp, sizeof tmp, "/%u%s", n, buf);
+		(void)snprintf(buf, size, "%s", tmp);
 	}
+	if (buf[0] == '\0')
+		(void)snprintf(buf, size, "/");
 }
 
-/* get menu of given window */
+/* get the menu at a path written by getmenupath(), or NULL */
 static struct Menu *
-getmenu(struct Menu *currmenu, Window win)
+getpathmenu(struct Menu *rootmenu, const char *path)
 {
 	struct Menu *menu;
-
-	for (menu = currmenu; menu != NULL; menu = menu->parent)
-		if (menu->win == win)
-			return menu;
-
-	return NULL;
-}
-
-/* get slice of given menu and position */
-static struct Slice *
-getslice(struct Menu *menu, int x, int y)
-{
 	struct Slice *slice;
-	double angle;
-	int r;
-
-	if (menu == NULL)
-		return NULL;
-
-	x -= pie.radius;
-	y -= pie.radius;
-	y = -y;
+	unsigned long n;
+	char *end;
 
-	/* if the cursor is in the middle disk, it is in no slice */
-	r = sqrt(x * x + y * y);
-	if (r <= pie.centerdiskradius)
+	if (strcmp(path, "-") == 0)
 		return NULL;
-
-	angle = atan2(y, x);
-	if (angle < 0.0) {
-		if (angle > -menu->half)
-			return menu->list;
-		angle = (2 * M_PI) + angle;
+	if (*path != '/')
+		errx(1, "replay: invalid menu path: %s", path);
+	menu = rootmenu;
+	for (path++; *path != '\0'; path = end) {
+		n = strtoul(path, &end, 10);
+		if (end == path || (*end != '/' && *end != '\0'))
+			errx(1, "replay: invalid menu path: %s", path);
+		if (*end == '/')
+			end++;
+		for (slice = menu->list; slice != NULL && n > 0; slice = slice->next)
+			n--;
+		if (slice == NULL || slice->submenu == NULL)
+			errx(1, "replay: menu path does not match the menu tree");
+		menu = slice->submenu;
 	}
-	for (slice = menu->list; slice; slice = slice->next)
-		if (angle >= slice->anglea && angle < slice->angleb)
-			return slice;
-
-	return NULL;
+	return menu;
 }
 
-/* umap previous menus and map current menu and its parents */
-static struct Menu *
-mapmenu(struct Menu *currmenu, struct Menu *prevmenu)
+/* write an event run() is about to handle into the record file */
+static void
+recordevent(XEvent *ev, uint64_t received)
 {
-	struct Menu *menu, *menu_;
-	struct Menu *lcamenu;   /* lowest common ancestor menu */
-	unsigned minlevel;      /* level of the closest to root menu */
-	unsigned maxlevel;      /* level of the closest to root menu */
-
-	/* do not remap current menu if it wasn't updated*/
-	if (prevmenu == currmenu)
-		goto done;
-
-	/* if this is the first time mapping, skip calculations */
-	if (prevmenu == NULL) {
-		XMapRaised(dpy, currmenu->win);
-		goto done;
-	}
-
-	/* find lowest common ancestor menu */
-	minlevel = MIN(currmenu->level, prevmenu->level);
-	maxlevel = MAX(currmenu->level, prevmenu->level);
-	if (currmenu->level == maxlevel) {
-		menu = currmenu;
-		menu_ = prevmenu;
-	} else {
-		menu = prevmenu;
-		menu_ = currmenu;
-	}
-	while (menu->level > minlevel)
-		menu = menu->parent;
-	while (menu != menu_) {
-		menu = menu->parent;
-		menu_ = menu_->parent;
-	}
-	lcamenu = menu;
+	char path[BUFSIZ];
+	char type;
+	int x = 0, y = 0;
+	unsigned long detail = 0;
+	unsigned state = 0;
 
-	/* unmap menus from currmenu (inclusive) until lcamenu (exclusive) */
-	for (menu = prevmenu; menu != lcamenu; menu = menu->parent) {
-		menu->selected = NULL;
-		XUnmapWindow(dpy, menu->win);
+	if (recordfp == NULL)
+		return;
+	switch (ev->type) {
+	case Expose:
+		type = 'E';
+		detail = ev->xexpose.count;
+		break;
+	case EnterNotify:
+	case LeaveNotify:
+		type = (ev->type == EnterNotify) ? 'N' : 'L';
+		x = ev->xcrossing.x;
+		y = ev->xcrossing.y;
+		break;
+	case MotionNotify:
+		type = 'M';
+		x = ev->xmotion.x;
+		y = ev->xmotion.y;
+		state = ev->xmotion.state;
+		break;
+	case ButtonPress:
+	case ButtonRelease:
+		type = (ev->type == ButtonPress) ? 'P' : 'R';
+		x = ev->xbutton.x;
+		y = ev->xbutton.y;
+		detail = ev->xbutton.button;
+		state = ev->xbutton.state;
+		break;
+	case KeyPress:
+		type = 'K';
+		detail = XkbKeycodeToKeysym(dpy, ev->xkey.keycode, 0, 0);
+		state = ev->xkey.state;
+		break;
+	case ConfigureNotify:
+		type = 'C';
+		x = ev->xconfigure.x;
+		y = ev->xconfigure.y;
+		break;
+	default:
+		return;
 	}
-
-	/* map menus from currmenu (inclusive) until lcamenu (exclusive) */
-	for (menu = currmenu; menu != lcamenu; menu = menu->parent)
-		XMapRaised(dpy, menu->win);
-
-done:
-	return currmenu;
+	getmenupath(pmenu_findmenu(pm->rootmenu, ev->xany.window), path, sizeof path);
+	(void)fprintf(recordfp, "%llu %c %s %d %d %lu %u\n",
+	              (unsigned long long)(lastevent ? received - lastevent : 0),
+	              type, path, x, y, detail, state);
+	lastevent = received;
 }
 
-/* umap urrent menu and its parents */
-static void
-unmapmenu(struct Menu *currmenu)
+/* read the next event from the replay file into ev; return 0 at its end */
+static int
+replayevent(XEvent *ev)
 {
+	struct timespec ts;
 	struct Menu *menu;
-
-	/* unmap menus from currmenu (inclusive) until lcamenu (exclusive) */
-	for (menu = currmenu; menu; menu = menu->parent) {
-		menu->selected = NULL;
-		XUnmapWindow(dpy, menu->win);
+	unsigned long long delay;
+	unsigned long detail;
+	unsigned state;
+	char buf[BUFSIZ];
+	char path[BUFSIZ];
+	char type;
+	int x, y;
+	int rootx, rooty;
+
+	memset(ev, 0, sizeof *ev);
+	if (fgets(buf, sizeof buf, replayfp) == NULL)
+		return 0;
+	if (sscanf(buf, "%llu %c %s %d %d %lu %u", &delay, &type, path,
+	           &x, &y, &detail, &state) != 7)
+		errx(1, "replay: invalid event: %s", buf);
+	if (!fflag && delay > 0) {
+		ts.tv_sec = delay / 1000000;
+		ts.tv_nsec = (delay % 1000000) * 1000;
+		while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+			;
+	}
+	menu = getpathmenu(pm->rootmenu, path);
+	ev->xany.display = dpy;
+	ev->xany.send_event = True;
+	ev->xany.window = (menu != NULL) ? menu->win : rootwin;
+	rootx = (menu != NULL) ? menu->x + pm->pie.border + x : x;
+	rooty = (menu != NULL) ? menu->y + pm->pie.border + y : y;
+	switch (type) {
+	case 'E':
+		ev->type = Expose;
+		ev->xexpose.count = detail;
+		break;
+	case 'N':
+	case 'L':
+		ev->type = (type == 'N') ? EnterNotify : LeaveNotify;
+		ev->xcrossing.x = x;
+		ev->xcrossing.y = y;
+		break;
+	case 'M':
+		ev->type = MotionNotify;
+		ev->xmotion.x = x;
+		ev->xmotion.y = y;
+		ev->xmotion.x_root = rootx;
+		ev->xmotion.y_root = rooty;
+		ev->xmotion.state = state;
+		break;
+	case 'P':
+	case 'R':
+		ev->type = (type == 'P') ? ButtonPress : ButtonRelease;
+		ev->xbutton.x = x;
+		ev->xbutton.y = y;
+		ev->xbutton.x_root = rootx;
+		ev->xbutton.y_root = rooty;
+		ev->xbutton.button = detail;
+		ev->xbutton.state = state;
+		break;
+	case 'K':
+		ev->type = KeyPress;
+		ev->xkey.keycode = XKeysymToKeycode(dpy, detail);
+		ev->xkey.state = state;
+		break;
+	case 'C':
+		ev->type = ConfigureNotify;
+		ev->xconfigure.window = ev->xany.window;
+		ev->xconfigure.x = x;
+		ev->xconfigure.y = y;
+		break;
+	default:
+		errx(1, "replay: invalid event type: %c", type);
 	}
+	return 1;
 }
 
-/* draw background of selected slice */
-static void
-drawslice(struct Menu *menu, struct Slice *slice)
+/* count the menus of the tree drawn at least once */
+static unsigned long
+countdrawn(struct Menu *menu)
 {
-	XPointDouble *p;
-	int i, outer, inner, npoints;
-	double h, a, b;
-
-	/* determine number of segments to draw */
-	/*h = hypot(pie.radius, pie.radius)/2;*/
-	/*outer = ((2 * M_PI) / (menu->nslices * acos(h/(h+1.0)))) + 0.5;*/
-	/*outer = (outer < 3) ? 3 : outer;*/
-	/*h = hypot(pie.centerdiskradius, pie.centerdiskradius)/2;*/
-	/*inner = ((2 * M_PI) / (menu->nslices * acos(h/(h+1.0)))) + 0.5;*/
-	/*inner = (inner < 3) ? 3 : inner;*/
-    outer = inner = 360;
-	npoints = inner + outer + 2;
-	p = emalloc(npoints * sizeof *p);
-
-	b = ((2 * M_PI) / menu->nslices) * slice->slicen;
-
-	/* outer points */
-	a = ((2 * M_PI) / (menu->nslices * outer));
-	for (i = 0; i <= outer; i++) {
-		p[i].x = pie.radius + (pie.radius + 1) * cos((i - (outer / 2.0)) * a - b);
-		p[i].y = pie.radius + (pie.radius + 1) * sin((i - (outer / 2.0)) * a - b);
-	}
-
-	/* inner points */
-	a = ((2 * M_PI) / (menu->nslices * inner));
-	for (i = 0; i <= inner; i++) {
-		p[i + outer + 1].x = pie.radius + pie.centerdiskradius * cos(((inner - i) - (inner / 2.0)) * a - b);
-		p[i + outer + 1].y = pie.radius + pie.centerdiskradius * sin(((inner - i) - (inner / 2.0)) * a - b);
-	}
-	
-	XRenderCompositeDoublePoly(dpy, PictOpOver, pie.selbg, slice->picture,
-	                           XRenderFindStandardFormat(dpy, PictStandardA8),
-	                           0, 0, 0, 0, p, npoints, 0);
+	struct Slice *slice;
+	unsigned long n;
 
-	free(p);
+	n = menu->drawn;
+	for (slice = menu->list; slice != NULL; slice = slice->next)
+		if (slice->submenu != NULL)
+			n += countdrawn(slice->submenu);
+	return n;
 }
 
-/* draw separator before slice */
+/* get work done so far */
 static void
-drawseparator(Picture picture, struct Menu *menu, struct Slice *slice)
+getwork(struct Work *work)
 {
-	XPointDouble p[4];
-	double a;
-
-	a = -((M_PI + 2 * M_PI * slice->slicen) / menu->nslices);
-	p[0].x = pie.radius + pie.separatorbeg * cos(a - pie.innerangle);
-	p[0].y = pie.radius + pie.separatorbeg * sin(a - pie.innerangle);
-	p[1].x = pie.radius + pie.separatorbeg * cos(a + pie.innerangle);
-	p[1].y = pie.radius + pie.separatorbeg * sin(a + pie.innerangle);
-	p[2].x = pie.radius + pie.separatorend * cos(a + pie.outerangle);
-	p[2].y = pie.radius + pie.separatorend * sin(a + pie.outerangle);
-	p[3].x = pie.radius + pie.separatorend * cos(a - pie.outerangle);
-	p[3].y = pie.radius + pie.separatorend * sin(a - pie.outerangle);
-	XRenderCompositeDoublePoly(dpy, PictOpOver, pie.separator, picture,
-	                           XRenderFindStandardFormat(dpy, PictStandardA8),
-	                           0, 0, 0, 0, p, 4, 0);
+	work->requests = NextRequest(dpy);
+	work->frames = pm->nframes;
+	work->draws = pm->ndraws;
+	work->allocs = 0;
+	work->menus = countdrawn(pm->rootmenu);
+	work->time = getmicros();
 }
 
-/* draw triangle for slice with submenu */
+/* report the work done to handle a replayed event, if ev was replayed */
 static void
-drawtriangle(Picture source, Picture picture, struct Menu *menu, struct Slice *slice)
+replayreport(XEvent *ev, struct Work *before)
 {
-	XPointDouble p[3];
-	double a;
-
-	a = - (((2 * M_PI) / menu->nslices) * slice->slicen);
-	p[0].x = pie.radius + pie.triangleinner * cos(a - pie.triangleangle);
-	p[0].y = pie.radius + pie.triangleinner * sin(a - pie.triangleangle);
-	p[1].x = pie.radius + pie.triangleouter * cos(a);
-	p[1].y = pie.radius + pie.triangleouter * sin(a);
-	p[2].x = pie.radius + pie.triangleinner * cos(a + pie.triangleangle);
-	p[2].y = pie.radius + pie.triangleinner * sin(a + pie.triangleangle);
-	XRenderCompositeDoublePoly(dpy, PictOpOver, source, picture,
-	                           XRenderFindStandardFormat(dpy, PictStandardA8),
-	                           0, 0, 0, 0, p, 3, 0);
+	struct Work after;
+	char path[BUFSIZ];
+
+	if (replayfp == NULL || !ev->xany.send_event)
+		return;
+	XFlush(dpy);
+	getwork(&after);
+	after.time -= before->time;
+	after.requests -= before->requests;
+	after.frames -= before->frames;
+	after.draws -= before->draws;
+	after.menus -= before->menus;
+	after.allocs = handleallocs;
+	getmenupath(pmenu_findmenu(pm->rootmenu, ev->xany.window), path, sizeof path);
+	(void)fprintf(stderr, "%s: replay %2d %-10s %9.3fms %5lu requests %3lu draws %3lu frames %3lu allocs\n",
+	              PROGNAME, ev->type, path, after.time / 1e3,
+	              after.requests, after.draws, after.frames, after.allocs);
+	/* only the event drawing the first frame of a menu may allocate */
+	if (after.menus == 0 && after.allocs > 0)
+		steadyallocs++;
+	replaywork.events++;
+	replaywork.time += after.time;
+	replaywork.requests += after.requests;
+	replaywork.frames += after.frames;
+	replaywork.draws += after.draws;
+	replaywork.allocs += after.allocs;
 }
 
-/* draw regular slice */
+/* print the total work done by the replayed events */
 static void
-drawmenu(struct Menu *menu, struct Slice *selected)
+printreplay(void)
 {
-	struct Slice *slice;
-	XftColor *color;
-	XftDraw *draw;
-	Drawable pixmap;
-	Picture picture;
-	Picture source;
-
-	if (selected) {
-		pixmap = selected->pixmap;
-		picture = selected->picture;
-		selected->drawn = 1;
-	} else {
-		pixmap = menu->pixmap;
-		picture = menu->picture;
-		menu->drawn = 1;
-	}
+	if (replayfp == NULL)
+		return;
+	(void)fprintf(stderr, "%s: replay total: %lu events %.3fms %lu requests %lu draws %lu frames %lu allocs\n",
+	              PROGNAME, replaywork.events, replaywork.time / 1e3,
+	              replaywork.requests, replaywork.draws, replaywork.frames,
+	              replaywork.allocs);
+	if (steadyallocs > 0)
+		warnx("%lu replayed events allocated memory after the first frame of their menus",
+		      steadyallocs);
+}
 
-	/* draw background */
-	XSetForeground(dpy, dc.gc, dc.normal[ColorBG].pixel);
-	XFillRectangle(dpy, pixmap, dc.gc, 0, 0, pie.diameter, pie.diameter);
-	if (selected)
-		drawslice(menu, selected);
-
-    /* draw center disk */
-    XSetForeground(dpy, dc.gc, dc.border.pixel);
-    XFillArc(dpy, pixmap, dc.gc, pie.radius - pie.centerdiskradius - 1, pie.radius - pie.centerdiskradius - 1,
-            2 * pie.centerdiskradius + 1, 2 * pie.centerdiskradius + 1, 0, 360*64);
-
-	/* draw slice foreground */
-	for (slice = menu->list; slice; slice = slice->next) {
-		if (slice == selected) {
-			color = dc.selected;
-			source = pie.selfg;
-		} else {
-			color = dc.normal;
-			source = pie.fg;
-		}
+/* call strdup checking for error */
+static char *
+estrdup(const char *s)
+{
+	char *t;
 
-		if (slice->file) {      /* if there is an icon, draw it */
-			imlib_context_set_drawable(pixmap);
-			imlib_context_set_image(slice->icon);
-			imlib_render_image_on_drawable(slice->iconx, slice->icony);
-		} else {                /* otherwise, draw the label */
-			draw = XftDrawCreate(dpy, pixmap, visual, colormap);
-			XSetForeground(dpy, dc.gc, color[ColorFG].pixel);
-			drawtext(draw, &color[ColorFG], slice->labelx,
-			         slice->labely, slice->label);
-			XftDrawDestroy(draw);
-		}
+	if ((t = strdup(s)) == NULL)
+		err(1, "strdup");
+	return t;
+}
 
-		/* draw separator */
-		XSetForeground(dpy, dc.gc, dc.separator.pixel);
-	    double a = -((M_PI + 2 * M_PI * slice->slicen) / menu->nslices);
-        int linexi = pie.radius + pie.separatorbeg * cos(a);
-        int lineyi = pie.radius + pie.separatorbeg * sin(a);
-        int linexo = pie.radius + pie.separatorend * cos(a);
-        int lineyo = pie.radius + pie.separatorend * sin(a);
-        if (abs(linexo - linexi) <= 2) linexo = linexi;
-        if (abs(lineyo - lineyi) <= 2) lineyo = lineyi;
-		XDrawLine(dpy, pixmap, dc.gc, linexi, lineyi, linexo, lineyo);
-
-		/* draw triangle */
-		if (slice->submenu && tflag) {
-			drawtriangle(source, picture, menu, slice);
-		}
-	}
+/* compare usage entries by decreasing count */
+static int
+usagecmp(const void *a, const void *b)
+{
+	const struct Usage *ua = a, *ub = b;
 
-    /* draw inner border */
-    if(pie.border > 0) {
-        XSetForeground(dpy, dc.gc, dc.border.pixel);
-        XDrawArc(dpy, pixmap, dc.gc, pie.radius - pie.centerdiskradius, pie.radius - pie.centerdiskradius,
-               2 * pie.centerdiskradius, 2 * pie.centerdiskradius, 0, 360*64);
-    }
+	if (ua->count != ub->count)
+		return (ua->count < ub->count) ? 1 : -1;
+	return 0;
 }
 
-/* draw slices of the current menu and of its ancestors */
-static void
-copymenu(struct Menu *currmenu)
+/* read the usage file into usage, sorted by decreasing count; return the number of entries */
+static size_t
+readusage(struct Usage *usage)
 {
-	struct Menu *menu;
-	Drawable pixmap;
-
-	for (menu = currmenu; menu != NULL; menu = menu->parent) {
-		if (menu->selected) {
-			pixmap = menu->selected->pixmap;
-			if (!menu->selected->drawn)
-				drawmenu(menu, menu->selected);
-		} else {
-			pixmap = menu->pixmap;
-			if (!menu->drawn)
-				drawmenu(menu, NULL);
-		}
-		XCopyArea(dpy, pixmap, menu->win, dc.gc, 0, 0,
-			      pie.diameter, pie.diameter, 0, 0);
+	FILE *fp;
+	char buf[BUFSIZ];
+	char *path, *output, *end;
+	unsigned long long hash;
+	unsigned long count;
+	size_t n = 0;
+
+	if ((fp = fopen(usagefile, "re")) == NULL) {
+		if (errno != ENOENT)
+			warn("%s", usagefile);
+		return 0;
+	}
+	while (n < USAGEMAX && fgets(buf, sizeof buf, fp) != NULL) {
+		buf[strcspn(buf, "\n")] = '\0';
+		hash = strtoull(buf, &end, 16);
+		if (*end != ' ')
+			continue;
+		count = strtoul(end + 1, &path, 10);
+		if (*path != ' ' || (output = strchr(++path, '\t')) == NULL)
+			continue;
+		*output++ = '\0';
+		usage[n].hash = hash;
+		usage[n].count = count;
+		usage[n].path = estrdup(path);
+		usage[n].output = estrdup(output);
+		n++;
 	}
+	fclose(fp);
+	qsort(usage, n, sizeof *usage, usagecmp);
+	return n;
 }
 
-/* cycle through the slices; non-zero direction is next, zero is prev */
-static struct Slice *
-slicecycle(struct Menu *currmenu, int clockwise)
+/* free the strings of usage entries */
+static void
+freeusage(struct Usage *usage, size_t n)
 {
-	struct Slice *slice;
-	struct Slice *lastslice;
-
-	slice = NULL;
-	if (clockwise) {
-		for (lastslice = currmenu->list;
-		     lastslice != NULL && lastslice->next != NULL;
-		     lastslice = lastslice->next)
-			;
-		if (currmenu->selected == NULL)
-			slice = currmenu->list;
-		else if (currmenu->selected->prev != NULL)
-			slice = currmenu->selected->prev;
-		if (slice == NULL)
-			slice = lastslice;
-	} else {
-		if (currmenu->selected == NULL)
-			slice = currmenu->list;
-		else if (currmenu->selected->next != NULL)
-			slice = currmenu->selected->next;
-		if (slice == NULL)
-			slice = currmenu->list;
+	while (n-- > 0) {
+		free(usage[n].path);
+		free(usage[n].output);
 	}
-	return slice;
 }
 
-/* ungrab pointer and keyboard */
+/* prepare the slice paths most often selected in this menu specification */
 static void
-ungrab(void)
+loadusage(void)
 {
-	XUngrabPointer(dpy, CurrentTime);
-	XUngrabKeyboard(dpy, CurrentTime);
+	struct Usage usage[USAGEMAX];
+	size_t i, n;
+
+	n = readusage(usage);
+	for (i = 0; i < n; i++)
+		if (usage[i].hash == spechash && pmenu_prewarm(pm, usage[i].path) == -1)
+			break;
+	freeusage(usage, n);
 }
 
-/* run event loop */
+/*
+ * Count the selection of output through path.  The usage file keeps the
+ * USAGEMAX most selected entries, and is replaced atomically by writing
+ * a temporary file in the same directory and renaming it over.
+ */
 static void
-run(struct Menu *rootmenu)
+saveusage(const char *output)
 {
-	struct Menu *currmenu;
-	struct Menu *prevmenu;
-	struct Menu *menu = NULL;
-	struct Slice *slice = NULL;
-	KeySym ksym;
-	XEvent ev;
-
-	getmonitor();
-	prevmenu = NULL;
-	currmenu = rootmenu;
-	grabpointer();
-	grabkeyboard();
-	placemenu(currmenu);
-	prevmenu = mapmenu(currmenu, prevmenu);
-	while (!XNextEvent(dpy, &ev)) {
-		switch (ev.type) {
-		case Expose:
-			if (ev.xexpose.count == 0)
-				copymenu(currmenu);
-			break;
-		case EnterNotify:
-			menu = getmenu(currmenu, ev.xcrossing.window);
-			if (menu == NULL)
-				break;
-			prevmenu = mapmenu(currmenu, prevmenu);
-			copymenu(currmenu);
-			break;
-		case LeaveNotify:
-			menu = getmenu(currmenu, ev.xcrossing.window);
-			if (menu == NULL)
-				break;
-			if ((menu != rootmenu && menu == currmenu)
-                   || (menu == rootmenu && currmenu == rootmenu)) {
-                goto done;
-            }
+	struct Usage usage[USAGEMAX + 1];
+	char path[BUFSIZ];
+	char tmpfile[BUFSIZ];
+	FILE *fp;
+	size_t i, n;
+	int fd;
+
+	if (pmenu_getpath(pm, path, sizeof path) == -1)
+		return;
+	n = readusage(usage);
+	for (i = 0; i < n; i++)
+		if (usage[i].hash == spechash && strcmp(usage[i].path, path) == 0 &&
+		    strcmp(usage[i].output, output) == 0)
 			break;
-		case MotionNotify:
-			menu = getmenu(currmenu, ev.xbutton.window);
-			slice = getslice(menu, ev.xbutton.x, ev.xbutton.y);
-			if (menu == NULL)
-				break;
-			else if (slice == NULL)
-				menu->selected = NULL;
-			else {
-				menu->selected = slice;
-                /*if (slice->submenu)*/
-                    /*goto selectslice;*/
-            }
-			copymenu(currmenu);
+	if (i == n) {
+		usage[n].hash = spechash;
+		usage[n].count = 0;
+		usage[n].path = estrdup(path);
+		usage[n].output = estrdup(output);
+		n++;
+	}
+	usage[i].count++;
+	qsort(usage, n, sizeof *usage, usagecmp);
+	if (n > USAGEMAX)
+		freeusage(usage + --n, 1);
+
+	(void)snprintf(tmpfile, sizeof tmpfile, "%s.XXXXXX", usagefile);
+	/* hide the file from the commands spawned by -x */
+	if ((fd = mkstemp(tmpfile)) == -1 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1 ||
+	    (fp = fdopen(fd, "w")) == NULL) {
+		warn("%s", tmpfile);
+		if (fd != -1) {
+			close(fd);
+			unlink(tmpfile);
+		}
+		freeusage(usage, n);
+		return;
+	}
+	for (i = 0; i < n; i++)
+		(void)fprintf(fp, "%016llx %lu %s\t%s\n", (unsigned long long)usage[i].hash,
+		              usage[i].count, usage[i].path, usage[i].output);
+	if (fflush(fp) == EOF || fsync(fd) == -1 || fclose(fp) == EOF) {
+		warn("%s", tmpfile);
+		unlink(tmpfile);
+	} else if (rename(tmpfile, usagefile) == -1) {
+		warn("%s", usagefile);
+		unlink(tmpfile);
+	}
+	freeusage(usage, n);
+}
+
+/*
+ * Split command in place into words, with the quoting of the shell:
+ * single quotes, double quotes and backslashes.  Return the number of
+ * words, or -1 if the command uses any other syntax of the shell.
+ */
+static int
+splitwords(char *s, char *argv[], size_t max)
+{
+	char *t;
+	size_t argc;
+	int quote, c;
+
+	argc = 0;
+	t = s;
+	for (;;) {
+		while (*s == ' ' || *s == '\t')
+			s++;
+		if (*s == '\0')
 			break;
-		case ButtonRelease:
-			menu = getmenu(currmenu, ev.xbutton.window);
-			slice = getslice(menu, ev.xbutton.x, ev.xbutton.y);
-			if (menu == NULL || slice == NULL)
+		if (argc + 1 >= max)
+			return -1;
+		argv[argc++] = t;
+		for (quote = 0; *s != '\0'; s++) {
+			if (quote == '\'') {
+				if (*s == '\'')
+					quote = 0;
+				else
+					*t++ = *s;
+			} else if (*s == '\\') {
+				if (*++s == '\0')
+					return -1;
+				if (quote == '"' && strchr("\"\\$`", *s) == NULL)
+					*t++ = '\\';
+				*t++ = *s;
+			} else if (quote == '"') {
+				if (*s == '"')
+					quote = 0;
+				else if (*s == '$' || *s == '`')
+					return -1;
+				else
+					*t++ = *s;
+			} else if (*s == '\'' || *s == '"') {
+				quote = *s;
+			} else if (*s == ' ' || *s == '\t') {
 				break;
-selectslice:
-			if (slice->submenu) {
-				currmenu = slice->submenu;
+			} else if (strchr(SHELLMETA, *s) != NULL) {
+				return -1;
 			} else {
-				printf("%s\n", slice->output);
-				fflush(stdout);
-				goto done;
+				*t++ = *s;
 			}
-			prevmenu = mapmenu(currmenu, prevmenu);
-			currmenu->selected = NULL;
-			copymenu(currmenu);
-            if (!wflag)
-                XWarpPointer(dpy, None, currmenu->win, 0, 0, 0, 0, pie.radius, pie.radius);
-			break;
-		case ButtonPress:
-            menu = getmenu(currmenu, ev.xbutton.window);
-            slice = getslice(menu, ev.xbutton.x, ev.xbutton.y);
-            if (menu == NULL)
-                goto done;
-            else if (slice == NULL) {
-                if(menu == rootmenu)
-                    goto done;
-                else {
-                    currmenu = currmenu->parent;
-                    prevmenu = mapmenu(currmenu, prevmenu);
-                    currmenu->selected = NULL;
-                    copymenu(currmenu);
-                }
-            }
+		}
+		if (quote)
+			return -1;
+		c = *s;
+		*t++ = '\0';
+		if (c == '\0')
 			break;
-		case KeyPress:
-			ksym = XkbKeycodeToKeysym(dpy, ev.xkey.keycode, 0, 0);
+		s++;
+	}
+	argv[argc] = NULL;
 
-			/* esc closes pmenu when current menu is the root menu */
-			if (ksym == XK_Escape && currmenu->parent == NULL)
-				goto done;
+	/* variable assignments before the command need the shell */
+	if (argc > 0 && strchr(argv[0], '=') != NULL)
+		return -1;
+	return argc;
+}
 
-			/* Shift-Tab = ISO_Left_Tab */
-			if (ksym == XK_Tab && (ev.xkey.state & ShiftMask))
-				ksym = XK_ISO_Left_Tab;
-
-			/* cycle through menu */
-			slice = NULL;
-			if (ksym == XK_Tab) {
-				slice = slicecycle(currmenu, 1);
-			} else if (ksym == XK_ISO_Left_Tab) {
-				slice = slicecycle(currmenu, 0);
-			} else if ((ksym == XK_Return) &&
-			           currmenu->selected != NULL) {
-				slice = currmenu->selected;
-				goto selectslice;
-			} else if ((ksym == XK_Escape) &&
-			           currmenu->parent != NULL) {
-				slice = currmenu->parent->selected;
-				currmenu = currmenu->parent;
-				prevmenu = mapmenu(currmenu, prevmenu);
-			} else
-				break;
-			currmenu->selected = slice;
-			copymenu(currmenu);
-			break;
-		case ConfigureNotify:
-			menu = getmenu(currmenu, ev.xconfigure.window);
-			if (menu == NULL)
-				break;
-			menu->x = ev.xconfigure.x;
-			menu->y = ev.xconfigure.y;
-			break;
-		}
+/*
+ * Run command in its own session, so it outlives pmenu and does not get
+ * its signals.  A command that needs the shell is run by sh -c; any other
+ * is split into words and run directly.
+ */
+static void
+launch(const char *command)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	pid_t pid;
+	char *argv[LAUNCHARGS];
+	char *buf;
+
+	buf = estrdup(command);
+	if (splitwords(buf, argv, LEN(argv)) <= 0) {
+		argv[0] = "sh";
+		argv[1] = "-c";
+		argv[2] = (char *)command;
+		argv[3] = NULL;
 	}
-done:
-	unmapmenu(currmenu);
-	ungrab();
-	XFlush(dpy);
+	sigemptyset(&mask);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &mask);
+#ifdef POSIX_SPAWN_SETSID
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+#else
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+#endif
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	if ((errno = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ)) != 0)
+		warn("%s", argv[0]);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	free(buf);
+	timing("command launched");
 }
 
-/* recursivelly free pixmaps and destroy windows */
+/*
+ * Keep selecting until the user is done, if -s was given.  A broken
+ * pipe must not kill us with the grabs held, and the commands run for
+ * the selections are reaped by the system.
+ */
 static void
-cleanmenu(struct Menu *menu)
+initsticky(void)
 {
-	struct Slice *slice;
-	struct Slice *tmp;
+	struct sigaction sa;
 
-	slice = menu->list;
-	while (slice != NULL) {
-		if (slice->submenu != NULL)
-			cleanmenu(slice->submenu);
-		tmp = slice;
-		if (tmp->label != tmp->output)
-			free(tmp->label);
-		free(tmp->output);
-		XFreePixmap(dpy, slice->pixmap);
-		if (tmp->file != NULL) {
-			free(tmp->file);
-			if (tmp->icon != NULL) {
-				imlib_context_set_image(tmp->icon);
-				imlib_free_image();
-			}
-		}
-		slice = slice->next;
-		free(tmp);
+	if (!sflag)
+		return;
+	sa.sa_handler = SIG_IGN;
+	sa.sa_flags = 0;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGPIPE, &sa, NULL) == -1 || sigaction(SIGCHLD, &sa, NULL) == -1)
+		err(1, "sigaction");
+}
+
+/* output what was selected; return zero if it could not be written */
+static int
+emit(const char *output)
+{
+	if (xflag) {
+		launch(output);
+	} else if (printf("%s\n", output) < 0 || fflush(stdout) == EOF) {
+		if (errno != EPIPE)
+			warn("stdout");
+		return 0;
 	}
+	if (usagefile != NULL)
+		saveusage(output);
+	return 1;
+}
 
-	XFreePixmap(dpy, menu->pixmap);
-	XDestroyWindow(dpy, menu->win);
-	free(menu);
+/* whether the event selecting a leaf ends the session */
+static int
+endsession(XEvent *ev)
+{
+	if (!sflag)
+		return 1;
+	switch (ev->type) {
+	case ButtonRelease:
+		return (ev->xbutton.state & STICKYENDMASK) != 0;
+	case KeyPress:
+		return (ev->xkey.state & STICKYENDMASK) != 0;
+	}
+	return 0;
 }
 
-/* free pictures */
-static void
-cleanpictures(void)
+/*
+ * Wait for the next event, printing the latency histograms on SIGUSR1
+ * and showing the menus of a gesture when its stroke pauses.
+ * When replaying, the X server events other than Present notifications
+ * are discarded and the events come from the replay file instead.
+ * Return 0 when there are no more events.
+ */
+static int
+nextevent(XEvent *ev)
 {
-	XRenderFreePicture(dpy, pie.bg);
-	XRenderFreePicture(dpy, pie.fg);
-	XRenderFreePicture(dpy, pie.selbg);
-	XRenderFreePicture(dpy, pie.selfg);
-	XRenderFreePicture(dpy, pie.separator);
+	struct pollfd pfd;
+	int timeout, gt;
+	int ret;
+
+	if (replayfp != NULL) {
+		while (XPending(dpy) > 0) {
+			XNextEvent(dpy, ev);
+			resync();
+			if (ev->type == GenericEvent)
+				return 1;
+		}
+		resync();
+
+		/* the pause before the event was slept while reading it */
+		ret = replayevent(ev);
+		pmenu_tick(pm);
+		return ret;
+	}
+	pfd.fd = ConnectionNumber(dpy);
+	pfd.events = POLLIN;
+	for (;;) {
+		/*
+		 * XPending() reads the connection, which may queue a grab
+		 * reply without leaving the socket readable; drain the
+		 * replies before blocking, and check again for any events
+		 * read along with them.
+		 */
+		if (XPending(dpy) > 0)
+			break;
+		if (pollgrab())
+			continue;
+		if (dumplatency) {
+			dumplatency = 0;
+			printlatency();
+		}
+		timeout = pmenu_timeout(pm);
+		if ((gt = grabtimeout()) >= 0 && (timeout < 0 || gt < timeout))
+			timeout = gt;
+		if (poll(&pfd, 1, timeout) == -1 && errno != EINTR)
+			err(1, "poll");
+		resync();
+		pmenu_tick(pm);
+	}
+	XNextEvent(dpy, ev);
+	resync();
+	return 1;
 }
 
-/* cleanup drawing context */
+/* handle an event with the pie menu, counting the allocations it makes */
+static int
+handle(XEvent *ev, const char **output)
+{
+#ifdef CHECK
+	unsigned long n;
+	int ret;
+
+	n = nallocs;
+	ret = pmenu_handle(pm, ev, output);
+	handleallocs = nallocs - n;
+	return ret;
+#else
+	return pmenu_handle(pm, ev, output);
+#endif
+}
+
+/* run event loop */
 static void
-cleandc(void)
+run(void)
 {
-	XftColorFree(dpy, visual, colormap, &dc.normal[ColorBG]);
-	XftColorFree(dpy, visual, colormap, &dc.normal[ColorFG]);
-	XftColorFree(dpy, visual, colormap, &dc.selected[ColorBG]);
-	XftColorFree(dpy, visual, colormap, &dc.selected[ColorFG]);
-	XftColorFree(dpy, visual, colormap, &dc.separator);
-	XftColorFree(dpy, visual, colormap, &dc.border);
-	XFreeGC(dpy, dc.gc);
+	XEvent ev;
+	const char *output;
+	int phase;              /* phase the current event is accounted to */
+	int firstframe = 1;     /* whether the first frame was not drawn yet */
+	int kind;               /* kind of response to the current input event */
+	unsigned long frames;   /* number of frames before the current event */
+	uint64_t received;      /* local time the current event was received */
+	struct Work work;       /* work done before the current event */
+
+	/*
+	 * Send the grabs before querying the monitor, so their replies
+	 * arrive while the root menu is placed and drawn.  If another
+	 * process holds the grabs, they are retried from the event loop
+	 * and input is discarded until they are acquired.
+	 */
+	grab();
+	pmenu_map(pm);
+	timing("root menu mapped");
+	if (replayfp != NULL) {
+		waitgrab();
+#ifdef CHECK
+		countallocs = 1;
+#endif
+	}
+	account(PhaseStartup);
+	while (nextevent(&ev)) {
+		if (!grabbed.done && ISINPUT(ev.type))
+			continue;
+		received = getmicros();
+		recordevent(&ev, received);
+		if (replayfp != NULL)
+			getwork(&work);
+		frames = pm->nframes;
+		phase = (ev.type == MotionNotify) ? PhaseMotion : PhaseOther;
+		kind = LatencyNoop;
+		switch (handle(&ev, &output)) {
+		case PMENU_SELECT:
+			kind = LatencySelect;
+			break;
+		case PMENU_SUBMENU:
+			phase = PhaseSubmenu;
+			kind = LatencySubmenu;
+			break;
+		case PMENU_OUTPUT:
+			if (!emit(output) || endsession(&ev))
+				goto done;
+			kind = LatencySelect;
+			break;
+		case PMENU_CLOSE:
+			goto done;
+		}
+		if (firstframe && pm->nframes > 0) {
+			phase = PhaseFirstFrame;
+			firstframe = 0;
+		}
+		account(phase);
+		sampleheap();
+		latency(&ev, kind, pm->nframes != frames, received);
+		replayreport(&ev, &work);
+	}
+done:
+	replayreport(&ev, &work);
+	pmenu_unmap(pm);
+	ungrab();
+	XFlush(dpy);
 }
 
 /* pmenu: generate a pie menu from stdin and print selected entry to stdout */
 int
 main(int argc, char *argv[])
 {
-	struct Menu *rootmenu;
+	struct PMenuTree *tree;
+	pthread_t parser;
+	void *parsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &starttime);
+
+	/* get options */
+	pmenu_defaults(&config);
+	getoptions(&argc, &argv);
+
+	/* parse stdin into the menu tree while we connect to the server */
+	if ((tree = pmenu_tree_create()) == NULL)
+		exit(1);
+	if ((errno = pthread_create(&parser, NULL, parsethread, tree)) != 0)
+		err(1, "pthread_create");
 
 	/* open connection to server and set X variables */
 	if ((dpy = XOpenDisplay(NULL)) == NULL)
 		errx(1, "could not open display");
-	screen = DefaultScreen(dpy);
-	visual = DefaultVisual(dpy, screen);
-	rootwin = RootWindow(dpy, screen);
-	colormap = DefaultColormap(dpy, screen);
-	depth = DefaultDepth(dpy, screen);
-	xformat = XRenderFindVisualFormat(dpy, visual);
+	rootwin = DefaultRootWindow(dpy);
+	xconn = XGetXCBConnection(dpy);
+	initaccount();
+	initlatency();
+	initsticky();
 	if ((xrm = XResourceManagerString(dpy)) != NULL)
 		xdb = XrmGetStringDatabase(xrm);
+	timing("display opened");
 
 	/* get configuration */
 	getresources();
-	getoptions(&argc, &argv);
-
-	/* imlib2 stuff */
-	imlib_set_cache_size(2048 * 1024);
-	imlib_context_set_dither(1);
-	imlib_context_set_display(dpy);
-	imlib_context_set_visual(visual);
-	imlib_context_set_colormap(colormap);
-
-	/* initializers */
-	initdc();
-	initpie();
 
-	/* generate menus and set them up */
-	rootmenu = parsestdin();
-	if (rootmenu == NULL)
+	/* create the pie menu */
+	if ((pm = pmenu_create(dpy, DefaultScreen(dpy), &config)) == NULL)
+		exit(1);
+	if (Lflag)
+		pm->presented = latencypresented;
+	timing("colors, fonts and pie masks loaded");
+
+	/* wait for the menu tree and set it up */
+	if ((errno = pthread_join(parser, &parsed)) != 0)
+		err(1, "pthread_join");
+	if (parsed == NULL) {
+		if (aflag)
+			errx(1, "no applications found");
+		exit(1);
+	}
+	if (tree->root == NULL)
 		errx(1, "no menu generated");
-	setslices(rootmenu);
+	if (Bflag) {
+		benchmark(tree->root);
+		pmenu_tree_free(tree);
+		pmenu_destroy(pm);
+		XCloseDisplay(dpy);
+		return 0;
+	}
+	spechash = tree->hash;
+	pmenu_settree(pm, tree);
+	timing("root menu set up");
+	if (usagefile != NULL)
+		loadusage();
 
 	/* run event loop */
-	run(rootmenu);
+	run();
+	printaccount();
+	printmemory();
+	printlatency();
+	printreplay();
+	if (recordfp != NULL && fclose(recordfp) == EOF)
+		err(1, "fclose");
 
 	/* freeing stuff */
-	cleanmenu(rootmenu);
-	cleanpictures();
-	cleandc();
+	pmenu_destroy(pm);
 	XCloseDisplay(dpy);
 
-	return 0;
+	/* events that allocate without drawing fail the replay */
+	return steadyallocs > 0;
 }
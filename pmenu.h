@@ -6,27 +6,88 @@
 #define MIN(x,y)            ((x)<(y)?(x):(y))
 #define BETWEEN(x, a, b)    ((a) <= (x) && (x) <= (b))
 
+/* USDT probes for perf and bpftrace, compiled in with -DUSDT */
+#ifdef USDT
+#include <sys/sdt.h>
+#define PROBE1(name, a)             DTRACE_PROBE1(pmenu, name, a)
+#define PROBE2(name, a, b)          DTRACE_PROBE2(pmenu, name, a, b)
+#define PROBE3(name, a, b, c)       DTRACE_PROBE3(pmenu, name, a, b, c)
+#else
+#define PROBE1(name, a)
+#define PROBE2(name, a, b)
+#define PROBE3(name, a, b, c)
+#endif
+
 /* color enum */
 enum {ColorFG, ColorBG, ColorLast};
 
-/* configuration structure */
-struct Config {
-	const char *font;
-	const char *background_color;
-	const char *foreground_color;
-	const char *selbackground_color;
-	const char *selforeground_color;
-	const char *separator_color;
-	const char *border_color;
-	int border_pixels;
-	int separator_pixels;
-	int triangle_width;
-	int triangle_height;
-	int triangle_distance;
-	unsigned diameter_pixels;
-	double separatorbeg;
-	double separatorend;
-    double centerdiskradius;
+/* kinds of response to an input event, for latency histograms */
+enum {LatencySelect, LatencySubmenu, LatencyNoop, LatencyLast};
+
+/* histogram buckets: 2^LATSUBBITS linear buckets per power of two */
+#define LATSUBBITS          4
+#define LATMAXBITS          26  /* values are clamped to 2^26us (about 67s) */
+#define LATBUCKETS          ((LATMAXBITS - LATSUBBITS + 2) << LATSUBBITS)
+#define LATPENDING          64  /* inputs waiting for their frame */
+
+/* stroke segmentation of gestures */
+#define GESTURESTEP         4           /* pixels between samples of the stroke */
+#define GESTURETURN         (M_PI / 4)  /* turn that ends a segment of the stroke */
+#define BUTTONMASK          (Button1Mask | Button2Mask | Button3Mask | Button4Mask | Button5Mask)
+
+/* usage statistics */
+#define PREWARMMAX          8           /* slice paths prepared ahead of use */
+#define USAGEMAX            256         /* entries kept in the usage file */
+
+/* direct execution of the output */
+#define LAUNCHARGS          256         /* words of a command run without the shell */
+#define SHELLMETA           "|&;<>()$`*?[#~\n"
+
+/* files in the cache directory */
+#define NOTIME              (-1)        /* modification time of missing files */
+#define FONTCACHEMAGIC      "pmenu fonts 1\n"
+#define PIXELCACHEMAGIC     "PMPIXEL3"
+#define SLICESEGMENTS       360         /* segments of each arc of a selected slice */
+
+/* grab acquisition, in microseconds */
+#define GRABTIMEOUT         1000000     /* time to give up grabbing */
+#define GRABBACKOFF         500         /* first pause before retrying a grab */
+#define GRABBACKOFFMAX      16000       /* longest pause before retrying a grab */
+#define STICKYENDMASK       ShiftMask   /* modifiers making a selection the last with -s */
+#define ISINPUT(type)       ((type) == KeyPress || (type) == KeyRelease || \
+                             (type) == ButtonPress || (type) == ButtonRelease || \
+                             (type) == MotionNotify)
+
+/* bytes on the wire of a fixed-size XCB request followed by n bytes of data */
+#define XCBBYTES(req, n)    (sizeof(req) + (((n) + 3) & ~3))
+
+/* kinds of X resources pmenu makes, for the memory report */
+enum {MemWindow, MemMenu, MemSelection, MemIcons, MemShared, MemLast};
+#define TALLYLEVELS         8           /* deeper menus are tallied with the last level */
+
+/* phases to which X protocol traffic is attributed */
+enum {PhaseStartup, PhaseFirstFrame, PhaseMotion, PhaseSubmenu, PhaseOther, PhaseLast};
+
+/* code points whose fallback font was decided */
+struct FontRange {
+	FcChar32 first, last;
+	int font;                       /* index of the font pattern, -1 if none has them */
+};
+
+/* fontconfig matches remembered across runs, kept in the cache directory */
+struct FontCache {
+	char *key;                      /* font string and Xft resources matched for */
+	char **patterns;                /* matched patterns, the configured fonts first */
+	XftFont **open;                 /* font opened from each pattern, NULL if none yet */
+	size_t npatterns;
+	size_t nconfig;                 /* number of configured fonts */
+	struct FontRange *ranges;
+	size_t nranges;
+	char **watched;                 /* fontconfig files and font directories */
+	int64_t *mtimes;
+	size_t nwatched;
+	int dirty;                      /* whether the file must be written */
+	int nomem;                      /* whether an allocation failed, so the file is not kept */
 };
 
 /* draw context structure */
@@ -41,6 +102,7 @@ struct DC {
 	FcPattern *pattern;
 	XftFont **fonts;
 	size_t nfonts;
+	struct FontCache fontcache;
 
 	XRenderPictureAttributes pictattr;
 };
@@ -50,12 +112,15 @@ struct Slice {
 	char *label;            /* string to be drawed on the slice */
 	char *output;           /* string to be outputed when slice is clicked */
 	char *file;             /* filename of the icon */
-	size_t labellen;        /* strlen(label) */
+	FcChar32 *ucs;          /* code points of the label, decoded when parsed */
+	size_t ucslen;          /* number of code points of the label */
 
 	unsigned slicen;
 	int x, y;               /* position of the pointer of the slice */
 	int labelx, labely;     /* position of the label */
 	int iconx, icony;       /* position of the icon */
+	int iconw, iconh;       /* size of the icon, 0 if there is none */
+	int atlasx;             /* position of the icon in the atlas of the menu */
 	double anglea, angleb;  /* angle of the borders of the slice */
 
 	struct Slice *prev;     /* previous slice */
@@ -65,7 +130,7 @@ struct Slice {
 	int drawn;              /* whether the pixmap have been drawn */
 	Drawable pixmap;        /* pixmap containing the pie menu with the slice selected */
 	Picture picture;        /* XRender picture */
-	Imlib_Image icon;       /* icon */
+	XftDraw *draw;          /* Xft drawable of the pixmap */
 };
 
 /* menu structure */
@@ -78,17 +143,32 @@ struct Menu {
 	int x, y;               /* menu position */
 	double half;            /* angle of half a slice of the pie menu */
 	unsigned level;         /* menu level relative to root */
+	int laidout;            /* whether the slices have been laid out */
 
 	int drawn;              /* whether the pixmap have been drawn */
 	Drawable pixmap;        /* pixmap to draw the menu on */
 	Picture picture;        /* XRender picture */
-	Window win;             /* menu window to map on the screen */
+	XftDraw *draw;          /* Xft drawable of the pixmap */
+	Picture atlas;          /* ARGB picture with the icons of the slices side by side */
+	Window win;             /* menu window to map on the screen, None until set up */
+
+	uint32_t serial;        /* serial of the frame being presented, 0 if none */
+	uint64_t msc;           /* media stream counter of the last frame presented */
 };
 
 /* monitor and cursor geometry structure */
 struct Monitor {
 	int x, y, w, h;         /* monitor geometry */
 	int cursx, cursy;
+	unsigned buttons;       /* buttons held when the cursor was queried */
+};
+
+/* stroke of a gesture through menus that are not mapped */
+struct Gesture {
+	struct Menu *menu;      /* menu the stroke is in, NULL if no gesture */
+	int x, y;               /* root position where the current segment began */
+	int lastx, lasty;       /* root position of the last sample */
+	uint64_t time;          /* time in milliseconds of the last motion */
 };
 
 /* geometry of the pie and bitmap that shapes it */
@@ -111,9 +191,177 @@ struct Pie {
 	double innerangle;
 	double outerangle;
 
+	XPointDouble *points;   /* room for the outline of a selected slice */
+
 	Picture bg;
 	Picture fg;
 	Picture selbg;
 	Picture selfg;
 	Picture separator;
+	Picture centerdisk;     /* color of the center disk and inner border */
+	Picture centerdiskmask; /* A8 mask of the center disk and inner border */
+};
+
+/*
+ * Header of a file of rendered pixels of the root menu, followed by the
+ * ZPixmap image of the menu unselected and then with each slice selected.
+ */
+struct PixelHeader {
+	char magic[8];
+	uint64_t key;           /* hash of everything the pixels depend on */
+	uint32_t diameter;
+	uint32_t depth;
+	uint32_t bpp;           /* bits per pixel */
+	uint32_t bpl;           /* bytes per line */
+	uint32_t byteorder;
+	uint32_t nstates;       /* number of images */
+};
+
+/* rendered pixels of the root menu kept across runs */
+struct PixelCache {
+	uint64_t key;           /* key of the root menu, 0 if its pixels are not kept */
+	struct PixelHeader *map;/* pixels read from the cache file, or NULL */
+	size_t size;            /* size of the mapping */
+	FILE *fp;               /* file the pixels are written into while idle, or NULL */
+	char *tmp;              /* its temporary path */
+	unsigned nsaved;        /* number of states written into it */
+	uint32_t bpl;           /* bytes per line of the states written */
+};
+
+/* layers shared by the menus with the same number of slices */
+struct Geometry {
+	struct Geometry *next;
+	unsigned nslices;
+	Picture separators;     /* A8 mask of the separators */
+	Picture *wedges;        /* A8 mask of the wedge of each slice, None until used */
+	XTriangle *triangles;   /* submenu triangle of each slice */
+	XTriangle *scratch;     /* room for the triangles of a menu */
+};
+
+/* X resources of a kind made for menus of a level */
+struct Tally {
+	unsigned long count;
+	unsigned long bytes;            /* pixel storage in the server */
+};
+
+/* pie menu */
+struct PMenu {
+	Display *dpy;
+	xcb_connection_t *xconn;
+	Visual *visual;
+	Window rootwin;
+	Colormap colormap;
+	XRenderPictFormat *xformat;
+	XRenderPictFormat *alphaformat; /* A8 format of the masks of outlines */
+	int screen;
+	int depth;
+	int presentopcode;              /* opcode of the Present extension, 0 if absent */
+	uint32_t presentserial;         /* serial of the last frame presented */
+	Imlib_Context imlib;
+	struct IconIndex *icons;        /* index of the icon theme, opened on first use */
+	struct PixelCache pixels;       /* rendered pixels of the root menu */
+	struct Geometry *geometries;    /* outlines per number of slices */
+
+	struct PMenuConfig config;
+	struct DC dc;
+	struct Pie pie;
+	struct Monitor mon;
+	struct Gesture gesture;
+
+	struct Menu *rootmenu;
+	struct Menu *currmenu;          /* menu the user is on */
+	struct Menu *prevmenu;          /* menu the user was on */
+	struct Menu *outmenu;           /* menu of the slice last output */
+	struct Slice *outslice;         /* slice last output */
+
+	char *prewarm[PREWARMMAX];      /* slice paths to prepare while idle */
+	size_t nprewarm;
+
+	unsigned long nframes;          /* number of frames copied to windows */
+	unsigned long ndraws;           /* number of pixmaps drawn */
+	unsigned long roundtrips;       /* replies waited for with XCB */
+	unsigned long xcbbytes;         /* bytes of the requests sent with XCB */
+	struct Tally tally[TALLYLEVELS][MemLast];
+
+	/* called when a frame is presented, with its serial and time */
+	void (*presented)(void *arg, uint32_t serial, uint64_t ust);
+	void *presentedarg;
+};
+
+/* state of the pointer and keyboard grabs */
+struct Grab {
+	xcb_grab_pointer_cookie_t pcookie;
+	xcb_grab_keyboard_cookie_t kcookie;
+	int ppending, kpending;         /* whether the reply to a grab is awaited */
+	int pointer, keyboard;          /* whether each grab was acquired */
+	int done;                       /* whether both grabs were acquired */
+	int retries;
+	uint64_t start;                 /* time the grabs were first sent */
+	uint64_t retry;                 /* time to resend failed grabs, 0 if unset */
+	uint64_t backoff;               /* pause before the next retry */
+	uint64_t wait;                  /* time until both grabs were acquired */
+};
+
+/* menu tree being built */
+struct PMenuTree {
+	struct Menu *root;
+	struct Menu *prev;      /* menu the previous slice was added to */
+	unsigned long nlines;   /* lines parsed, for error messages */
+	uint64_t hash;          /* FNV-1a hash of the lines parsed */
 };
+
+/* how often an output was selected through a slice path of a menu specification */
+struct Usage {
+	uint64_t hash;          /* hash of the menu specification */
+	unsigned long count;
+	char *path;             /* slice path, like "/2/0/5" */
+	char *output;
+};
+
+/* X protocol traffic attributed to a phase */
+struct Traffic {
+	unsigned long count;        /* number of times the phase happened */
+	unsigned long requests;     /* requests sent */
+	unsigned long roundtrips;   /* replies waited for */
+	unsigned long bytes;        /* bytes written (0 if unknown) */
+};
+
+/* HDR-style histogram of latencies in microseconds */
+struct Histogram {
+	unsigned long count;
+	unsigned long buckets[LATBUCKETS];
+	uint64_t min, max, sum;
+};
+
+/* input event waiting for its response to be presented */
+struct Pending {
+	uint64_t time;          /* time of the event in microseconds, server clock */
+	uint32_t serial;        /* serial of the frame presented in response */
+	int kind;               /* kind of response */
+};
+
+/* work done handling events */
+struct Work {
+	unsigned long events;   /* events handled */
+	unsigned long requests; /* requests sent */
+	unsigned long frames;   /* frames presented */
+	unsigned long draws;    /* pixmaps drawn */
+	unsigned long allocs;   /* heap allocations made by pmenu_handle() */
+	unsigned long menus;    /* menus drawn at least once */
+	uint64_t time;          /* time in microseconds */
+};
+
+/* internals used by the pmenu program for benchmarking and replaying */
+/* icon theme index and XDG directories, in icons.c */
+int64_t getmtime(const char *path);
+int getdatadirs(char *dirs[], size_t max);
+int getcachepath(char *path, size_t size, const char *name);
+struct IconIndex *openiconindex(const char *theme);
+char *findicon(struct IconIndex *index, const char *name, int size);
+void closeiconindex(struct IconIndex *index);
+
+struct Menu *pmenu_findmenu(struct Menu *menu, Window win);
+struct Slice *pmenu_getslice(struct PMenu *pm, struct Menu *menu, int x, int y);
+void pmenu_layout(struct PMenu *pm, struct Menu *menu);
+int pmenu_textwidth(struct PMenu *pm, const FcChar32 *ucs, size_t len);
+FcChar32 *pmenu_utf8decode(const char *s, size_t *len_ret, int *invalid_ret);
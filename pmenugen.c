@@ -0,0 +1,158 @@
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAXDEPTH 32
+
+/* parameters of the generated menu specification */
+static unsigned widths[MAXDEPTH];       /* number of slices at each level */
+static unsigned nwidths = 0;
+static unsigned depth = 2;              /* number of levels */
+static unsigned labelmin = 4;           /* minimum label length in characters */
+static unsigned labelmax = 12;          /* maximum label length in characters */
+static double unicode = 0.0;            /* ratio of non-ASCII characters */
+static double images = 0.0;             /* ratio of IMG: entries */
+static const char *icon = NULL;         /* image of IMG: entries, given by -I */
+static unsigned outputlen = 16;         /* length of the output of entries */
+
+/* non-ASCII characters mixed into labels: 2, 3 and 4 byte UTF-8 sequences */
+static const char *utf8chars[] = {
+	"\xc3\xa9", "\xc3\xb1", "\xce\xbb", "\xd0\x96", "\xd7\x90",
+	"\xe2\x82\xac", "\xe2\x86\x92", "\xe3\x81\x82", "\xe4\xb8\xad", "\xea\xb0\x80",
+	"\xf0\x9f\x98\x80", "\xf0\x9d\x84\x9e",
+};
+
+/* show usage */
+static void
+usage(void)
+{
+	(void)fprintf(stderr,
+	              "usage: pmenugen [-d depth] [-I icon] [-i ratio] [-l min-max]\n"
+	              "                [-o length] [-s seed] [-u ratio] [-w width[,width...]]\n");
+	exit(1);
+}
+
+/* get number from string, exiting on error */
+static double
+getnum(const char *s, double min, double max)
+{
+	char *end;
+	double d;
+
+	d = strtod(s, &end);
+	if (end == s || *end != '\0' || d < min || d > max)
+		errx(1, "%s: invalid number", s);
+	return d;
+}
+
+/* get random number between 0 and 1 */
+static double
+randratio(void)
+{
+	return (double)rand() / ((double)RAND_MAX + 1);
+}
+
+/* print a label with random length and characters */
+static void
+printlabel(void)
+{
+	unsigned i, len;
+
+	len = labelmin + rand() % (labelmax - labelmin + 1);
+	for (i = 0; i < len; i++) {
+		if (randratio() < unicode)
+			fputs(utf8chars[rand() % (sizeof utf8chars / sizeof *utf8chars)], stdout);
+		else
+			putchar('a' + rand() % 26);
+	}
+}
+
+/* print the entries of a menu at given level, and recursivelly its submenus */
+static void
+printmenu(unsigned level, unsigned long *n)
+{
+	unsigned i, j, width;
+
+	width = widths[level < nwidths ? level : nwidths - 1];
+	for (i = 0; i < width; i++) {
+		for (j = 0; j < level; j++)
+			putchar('\t');
+		if (level + 1 < depth) {
+			printlabel();
+			putchar('\n');
+			printmenu(level + 1, n);
+			continue;
+		}
+		if (randratio() < images)
+			printf("IMG:%s", icon);
+		else
+			printlabel();
+		putchar('\t');
+		for (j = 0; j < outputlen; j++)
+			putchar('a' + (*n + j) % 26);
+		printf(" %lu\n", (*n)++);
+	}
+}
+
+/* pmenugen: generate a menu specification for benchmarking pmenu */
+int
+main(int argc, char *argv[])
+{
+	unsigned long n = 0;
+	char *s;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "d:I:i:l:o:s:u:w:")) != -1) {
+		switch (ch) {
+		case 'd':
+			depth = getnum(optarg, 1, MAXDEPTH);
+			break;
+		case 'I':
+			icon = optarg;
+			break;
+		case 'i':
+			images = getnum(optarg, 0.0, 1.0);
+			break;
+		case 'l':
+			if ((s = strchr(optarg, '-')) == NULL)
+				usage();
+			*s++ = '\0';
+			labelmin = getnum(optarg, 1, BUFSIZ / 8);
+			labelmax = getnum(s, labelmin, BUFSIZ / 8);
+			break;
+		case 'o':
+			outputlen = getnum(optarg, 0, BUFSIZ / 2);
+			break;
+		case 's':
+			srand(getnum(optarg, 0, (double)~0U));
+			break;
+		case 'u':
+			unicode = getnum(optarg, 0.0, 1.0);
+			break;
+		case 'w':
+			nwidths = 0;
+			for (s = strtok(optarg, ","); s != NULL; s = strtok(NULL, ",")) {
+				if (nwidths == MAXDEPTH)
+					errx(1, "too many widths");
+				widths[nwidths++] = getnum(s, 1, 1000000);
+			}
+			break;
+		default:
+			usage();
+			break;
+		}
+	}
+	if (argc > optind)
+		usage();
+	if (images > 0.0 && icon == NULL)
+		errx(1, "-i needs an image given with -I");
+	if (nwidths == 0)
+		widths[nwidths++] = 8;
+
+	printmenu(0, &n);
+	if (fflush(stdout) == EOF)
+		err(1, "stdout");
+	return 0;
+}
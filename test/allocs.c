@@ -0,0 +1,80 @@
+/*
+ * Count the heap allocations of pmenu, libraries included, for the
+ * replay of "make check".  This stands in for the allocator of the GNU
+ * C library and is only linked into pmenu-check, never into pmenu.
+ * Only the main thread runs while allocations are counted.
+ */
+#include <errno.h>
+#include <stddef.h>
+
+int countallocs;                        /* whether allocations are counted */
+unsigned long nallocs;                  /* allocations counted */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void *__libc_valloc(size_t size);
+
+void *
+malloc(size_t size)
+{
+	if (countallocs)
+		nallocs++;
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	if (countallocs)
+		nallocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *p, size_t size)
+{
+	if (countallocs)
+		nallocs++;
+	return __libc_realloc(p, size);
+}
+
+void *
+memalign(size_t alignment, size_t size)
+{
+	if (countallocs)
+		nallocs++;
+	return __libc_memalign(alignment, size);
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size)
+{
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	return memalign(alignment, size);
+}
+
+int
+posix_memalign(void **p, size_t alignment, size_t size)
+{
+	void *q;
+
+	if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+		return EINVAL;
+	if ((q = memalign(alignment, size)) == NULL)
+		return ENOMEM;
+	*p = q;
+	return 0;
+}
+
+void *
+valloc(size_t size)
+{
+	if (countallocs)
+		nallocs++;
+	return __libc_valloc(size);
+}